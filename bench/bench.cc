@@ -0,0 +1,334 @@
+// bench.cc
+
+// Microbenchmarks of the update kernels on each type of lattice. Each kernel
+// is called repeatedly for at least min_time seconds, and the time per unit of
+// work (site update, cluster site, etc.) is reported along with the memory
+// used by the lattice and the field. The results are written to stdout as
+// JSON so that they can be compared between builds.
+
+#include <getopt.h>
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "ads2.h"
+#include "ads3.h"
+#include "ads_strip.h"
+#include "ising.h"
+#include "lattice.h"
+#include "phi4.h"
+#include "s2.h"
+#include "s3.h"
+#include "timer.h"
+
+struct BenchResult {
+  std::string lattice;
+  std::string kernel;
+  std::string unit;
+  int n_sites;
+  long lattice_bytes;
+  long field_bytes;
+  long calls;
+  double seconds;
+  double work;
+};
+
+template <typename T>
+long VectorBytes(const std::vector<T>& v) {
+  return long(v.capacity()) * sizeof(T);
+}
+
+// memory used by the base lattice data (not including derived class data)
+long LatticeBytes(QfeLattice& lattice) {
+  long bytes = 0;
+  bytes += VectorBytes(lattice.sites);
+  bytes += VectorBytes(lattice.links);
+  bytes += VectorBytes(lattice.faces);
+  bytes += VectorBytes(lattice.cells);
+  bytes += VectorBytes(lattice.distinct_n_sites);
+  bytes += VectorBytes(lattice.distinct_first);
+  bytes += VectorBytes(lattice.adj_offset);
+  bytes += VectorBytes(lattice.adj_sites);
+  bytes += VectorBytes(lattice.adj_links);
+  bytes += VectorBytes(lattice.adj_wt);
+  bytes += VectorBytes(lattice.site_color);
+  bytes += VectorBytes(lattice.color_offset);
+  bytes += VectorBytes(lattice.color_sites);
+  bytes += VectorBytes(lattice.block_rng);
+  return bytes;
+}
+
+long IsingBytes(QfeIsing& field) {
+  long bytes = 0;
+  bytes += VectorBytes(field.spin);
+  bytes += VectorBytes(field.rand_buf);
+  bytes += VectorBytes(field.cluster_stamp);
+  bytes += VectorBytes(field.cluster_stack);
+  bytes += VectorBytes(field.wolff_cluster);
+  bytes += VectorBytes(field.sw_root);
+  bytes += VectorBytes(field.sw_flip);
+  bytes += VectorBytes(field.adj_p_bond);
+  return bytes;
+}
+
+long Phi4Bytes(QfePhi4& field) {
+  long bytes = 0;
+  bytes += VectorBytes(field.phi);
+  bytes += VectorBytes(field.msq_ct);
+  bytes += VectorBytes(field.rand_buf);
+  bytes += VectorBytes(field.cluster_stamp);
+  bytes += VectorBytes(field.cluster_stack);
+  bytes += VectorBytes(field.wolff_cluster);
+  bytes += VectorBytes(field.sw_root);
+  bytes += VectorBytes(field.sw_flip);
+  bytes += long(field.is_fixed.capacity()) / 8;
+  return bytes;
+}
+
+class Bench {
+ public:
+  Bench(double min_time, const std::string& filter);
+  bool Selected(const std::string& lattice, const std::string& kernel);
+  void Run(QfeLattice& lattice, const std::string& lattice_name,
+           const std::string& kernel, const std::string& unit,
+           long field_bytes, std::function<double()> kernel_func);
+  void BenchLattice(QfeLattice& lattice, const std::string& lattice_name);
+  void WriteJson(FILE* file);
+
+  double min_time;     // minimum time for each kernel (seconds)
+  std::string filter;  // only run benchmarks whose name contains this
+  std::vector<BenchResult> results;
+};
+
+Bench::Bench(double min_time, const std::string& filter) {
+  this->min_time = min_time;
+  this->filter = filter;
+}
+
+bool Bench::Selected(const std::string& lattice, const std::string& kernel) {
+  if (filter.empty()) return true;
+  std::string name = lattice + "/" + kernel;
+  return name.find(filter) != std::string::npos;
+}
+
+// time a kernel. kernel_func does one call and returns the units of work done.
+// the first call is not timed, so that buffers and tables are set up.
+void Bench::Run(QfeLattice& lattice, const std::string& lattice_name,
+                const std::string& kernel, const std::string& unit,
+                long field_bytes, std::function<double()> kernel_func) {
+  if (!Selected(lattice_name, kernel)) return;
+  kernel_func();
+
+  BenchResult result;
+  result.lattice = lattice_name;
+  result.kernel = kernel;
+  result.unit = unit;
+  result.n_sites = lattice.n_sites;
+  result.lattice_bytes = LatticeBytes(lattice);
+  result.field_bytes = field_bytes;
+  result.calls = 0;
+  result.work = 0.0;
+
+  Timer timer;
+  do {
+    result.work += kernel_func();
+    result.calls++;
+  } while (timer.Duration() < min_time);
+  timer.Stop();
+  result.seconds = timer.Duration();
+
+  fprintf(stderr, "%-24s %-24s %10.3f ns/%s\n", lattice_name.c_str(),
+          kernel.c_str(), 1.0e9 * result.seconds / result.work, unit.c_str());
+  results.push_back(result);
+}
+
+// run every kernel on a lattice
+void Bench::BenchLattice(QfeLattice& lattice, const std::string& lattice_name) {
+  int n_sites = lattice.n_sites;
+  lattice.SeedRng(1234);
+
+  QfeIsing ising(&lattice, 0.3);
+  ising.HotStart();
+  long ising_bytes = IsingBytes(ising);
+  Run(lattice, lattice_name, "ising.Metropolis", "site-update", ising_bytes,
+      [&]() {
+        ising.Metropolis();
+        return double(n_sites);
+      });
+  Run(lattice, lattice_name, "ising.WolffUpdate", "cluster-site", ising_bytes,
+      [&]() { return double(ising.WolffUpdate()); });
+  Run(lattice, lattice_name, "ising.SWUpdate", "site-update", ising_bytes,
+      [&]() {
+        ising.SWUpdate();
+        return double(n_sites);
+      });
+  Run(lattice, lattice_name, "ising.Action", "site", ising_bytes, [&]() {
+    ising.Action();
+    return double(n_sites);
+  });
+
+  QfePhi4 phi4(&lattice, -0.5, 0.25);
+  phi4.HotStart();
+  long phi4_bytes = Phi4Bytes(phi4);
+  Run(lattice, lattice_name, "phi4.Metropolis", "site-update", phi4_bytes,
+      [&]() {
+        phi4.Metropolis();
+        return double(n_sites);
+      });
+  Run(lattice, lattice_name, "phi4.Overrelax", "site-update", phi4_bytes,
+      [&]() {
+        phi4.Overrelax();
+        return double(n_sites);
+      });
+  Run(lattice, lattice_name, "phi4.WolffUpdate", "cluster-site", phi4_bytes,
+      [&]() { return double(phi4.WolffUpdate()); });
+  Run(lattice, lattice_name, "phi4.SWUpdate", "site-update", phi4_bytes,
+      [&]() {
+        phi4.SWUpdate();
+        return double(n_sites);
+      });
+  Run(lattice, lattice_name, "phi4.Action", "site", phi4_bytes, [&]() {
+    phi4.Action();
+    return double(n_sites);
+  });
+
+  // one cg solve per distinct site weight, so only run on small lattices
+  if (n_sites <= 5000) {
+    Run(lattice, lattice_name, "phi4.MInverse", "site", phi4_bytes, [&]() {
+      phi4.MInverse(1.0);
+      return double(n_sites);
+    });
+  }
+}
+
+// project an ising configuration onto spherical harmonics, as in
+// ising_s2_crit.cc
+void BenchYlm(Bench& bench, QfeLatticeS2& lattice,
+              const std::string& lattice_name, int l_max) {
+  if (!bench.Selected(lattice_name, "s2.YlmProjection")) return;
+  int n_ylm = ((l_max + 1) * (l_max + 2)) / 2;
+  Eigen::MatrixXcd ylm(lattice.n_sites, n_ylm);
+  for (int s = 0; s < lattice.n_sites; s++) {
+    for (int y_i = 0, y_l = 0, y_m = 0; y_i < n_ylm; y_i++) {
+      ylm(s, y_i) = lattice.CalcYlm(s, y_l, y_m);
+      if (++y_m > y_l) {
+        y_l++;
+        y_m = 0;
+      }
+    }
+  }
+
+  QfeIsing field(&lattice, 0.3);
+  field.HotStart();
+  std::vector<Complex> ylm_sum(n_ylm);
+  long bytes = IsingBytes(field) + long(ylm.size()) * sizeof(Complex);
+  bench.Run(lattice, lattice_name, "s2.YlmProjection", "site", bytes, [&]() {
+    std::fill(ylm_sum.begin(), ylm_sum.end(), 0.0);
+    for (int s = 0; s < lattice.n_sites; s++) {
+      double wt = field.spin[s] * lattice.sites[s].wt;
+      for (int y_i = 0; y_i < n_ylm; y_i++) ylm_sum[y_i] += ylm(s, y_i) * wt;
+    }
+    return double(lattice.n_sites);
+  });
+}
+
+void Bench::WriteJson(FILE* file) {
+  fprintf(file, "{\n  \"results\": [\n");
+  for (int i = 0; i < results.size(); i++) {
+    const BenchResult& r = results[i];
+    fprintf(file, "    {\"lattice\": \"%s\", \"kernel\": \"%s\", ",
+            r.lattice.c_str(), r.kernel.c_str());
+    fprintf(file, "\"n_sites\": %d, \"lattice_bytes\": %ld, ", r.n_sites,
+            r.lattice_bytes);
+    fprintf(file, "\"field_bytes\": %ld, \"calls\": %ld, ", r.field_bytes,
+            r.calls);
+    fprintf(file, "\"seconds\": %.6e, \"unit\": \"%s\", ", r.seconds,
+            r.unit.c_str());
+    fprintf(file, "\"ns_per_unit\": %.6e}%s\n", 1.0e9 * r.seconds / r.work,
+            i + 1 < results.size() ? "," : "");
+  }
+  fprintf(file, "  ]\n}\n");
+}
+
+int main(int argc, char* argv[]) {
+  double min_time = 0.2;
+  bool quick = false;
+  std::string filter;
+
+  const struct option long_options[] = {
+    { "min_time", required_argument, 0, 't' },
+    { "filter", required_argument, 0, 'f' },
+    { "quick", no_argument, 0, 'q' },
+    { 0, 0, 0, 0 }
+  };
+
+  const char* short_options = "t:f:q";
+
+  while (true) {
+
+    int o = 0;
+    int c = getopt_long(argc, argv, short_options, long_options, &o);
+    if (c == -1) break;
+
+    switch (c) {
+      case 't': min_time = std::stod(optarg); break;
+      case 'f': filter = optarg; break;
+      case 'q': quick = true; break;
+      default: break;
+    }
+  }
+
+  Bench bench(min_time, filter);
+
+  // flat lattices
+  std::vector<int> flat_N = quick ? std::vector<int>{32}
+                                  : std::vector<int>{32, 128, 512};
+  for (int N : flat_N) {
+    QfeLattice rect;
+    rect.InitRect(N, N, 1.0, 1.0);
+    bench.BenchLattice(rect, string_format("rect_%d", N));
+
+    QfeLattice triangle;
+    triangle.InitTriangle(N, 1.0, 1.0, 1.0);
+    bench.BenchLattice(triangle, string_format("triangle_%d", N));
+  }
+
+  // sphere
+  std::vector<int> s2_k = quick ? std::vector<int>{8}
+                                : std::vector<int>{8, 32, 128};
+  for (int q = 3; q <= 5; q++) {
+    for (int k : s2_k) {
+      QfeLatticeS2 lattice(q, k);
+      std::string name = string_format("s2_q%dk%d", q, k);
+      bench.BenchLattice(lattice, name);
+      BenchYlm(bench, lattice, name, 8);
+    }
+  }
+
+  // 3-sphere
+  std::vector<int> s3_k = quick ? std::vector<int>{2}
+                                : std::vector<int>{2, 4, 8};
+  for (int k : s3_k) {
+    QfeLatticeS3 lattice(5, k);
+    bench.BenchLattice(lattice, string_format("s3_q5k%d", k));
+  }
+
+  // anti-de sitter
+  int ads_layers = quick ? 5 : 8;
+  QfeLatticeAdS2 ads2(ads_layers, 7);
+  bench.BenchLattice(ads2, string_format("ads2_n%dq7", ads_layers));
+
+  int ads3_layers = quick ? 2 : 3;
+  QfeLatticeAdS3 ads3(ads3_layers, 7);
+  bench.BenchLattice(ads3, string_format("ads3_n%dq7", ads3_layers));
+
+  int strip_n = quick ? 16 : 64;
+  QfeLatticeAdSStrip strip(strip_n, 4 * strip_n);
+  bench.BenchLattice(strip, string_format("ads_strip_%d", strip_n));
+
+  bench.WriteJson(stdout);
+  return 0;
+}
@@ -0,0 +1,405 @@
+// regress.cc
+
+// Performance and reproducibility regression check. A fixed set of markov
+// chains (ising and phi4, serial and parallel updates) is run on a fixed set
+// of lattices and seeds. Each chain is repeated n_trials times, and the
+// median and median absolute deviation (MAD) of the time per site update are
+// compared with a baseline file. The final field and rng state of each chain
+// (as written by WriteField and WriteRng) are hashed, and the hash must match
+// the baseline exactly, so that optimizations can't silently change the
+// chains. Any slowdown or changed hash is reported and the exit status is 1.
+// The hashes don't depend on the machine, so a reference file with only the
+// hashes (chains.dat) is kept in the repository. Timing baselines are only
+// meaningful on the machine that recorded them, and are kept locally.
+//
+// usage:
+//   regress --write baseline.dat               (record a new baseline)
+//   regress --write --hash_only chains.dat     (record only the hashes)
+//   regress baseline.dat                       (check against the baseline)
+//   regress --hash_only -n 1 chains.dat        (check only the hashes)
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ads2.h"
+#include "ads3.h"
+#include "ads_strip.h"
+#include "ising.h"
+#include "lattice.h"
+#include "phi4.h"
+#include "s2.h"
+#include "s3.h"
+#include "timer.h"
+
+struct RegressEntry {
+  std::string lattice;
+  std::string chain;
+  int seed;
+  int n_sweeps;
+  uint64_t hash;     // hash of the final field and rng state
+  double ns_median;  // median time per site update (ns)
+  double ns_mad;     // median absolute deviation of the time per site update
+  bool timed;        // false if the baseline has no timing for this chain
+};
+
+double Median(std::vector<double> x) {
+  std::sort(x.begin(), x.end());
+  int n = x.size();
+  if (n == 0) return 0.0;
+  return (n % 2) ? x[n / 2] : 0.5 * (x[n / 2 - 1] + x[n / 2]);
+}
+
+double MedianAbsDev(const std::vector<double>& x) {
+  double median = Median(x);
+  std::vector<double> dev(x.size());
+  for (int i = 0; i < x.size(); i++) dev[i] = fabs(x[i] - median);
+  return Median(dev);
+}
+
+// hash the field and all of the lattice random number generators
+template <class Field>
+uint64_t ChainHash(Field& field, QfeLattice& lattice) {
+  FILE* file = tmpfile();
+  field.WriteField(file);
+  lattice.rng.WriteRng(file);
+  lattice.counter_rng.WriteRng(file);
+  for (int b = 0; b < lattice.block_rng.size(); b++) {
+    lattice.block_rng[b].WriteRng(file);
+  }
+  long size = ftell(file);
+  std::vector<char> buf(size);
+  rewind(file);
+  size = fread(buf.data(), 1, size, file);
+  fclose(file);
+  return Fnv1aHash(buf.data(), size);
+}
+
+class Regress {
+ public:
+  Regress(int n_trials, int n_sweeps, int n_threads);
+  template <class Field>
+  void RunChain(QfeLattice& lattice, const std::string& lattice_name,
+                const std::string& chain, int seed,
+                std::function<Field()> make,
+                std::function<void(Field&)> sweep);
+  void RunLattice(QfeLattice& lattice, const std::string& lattice_name);
+  bool WriteBaseline(const char* path, bool timing);
+  int Compare(const std::vector<RegressEntry>& baseline, double n_sigma,
+              double tolerance, bool hash_only);
+
+  int n_trials;   // number of times to repeat each chain
+  int n_sweeps;   // sweeps per chain
+  int n_threads;  // threads for the parallel updates (0 for one per core)
+  std::vector<int> seeds;
+  std::vector<RegressEntry> results;
+  int n_nondeterministic;  // chains whose hash changed between trials
+};
+
+Regress::Regress(int n_trials, int n_sweeps, int n_threads) {
+  this->n_trials = n_trials;
+  this->n_sweeps = n_sweeps;
+  this->n_threads = n_threads;
+  seeds = {1234, 5678};
+  n_nondeterministic = 0;
+}
+
+// run a chain n_trials times from the same seed and record the median time
+// per site update. every trial must end in the same state.
+template <class Field>
+void Regress::RunChain(QfeLattice& lattice, const std::string& lattice_name,
+                       const std::string& chain, int seed,
+                       std::function<Field()> make,
+                       std::function<void(Field&)> sweep) {
+  RegressEntry entry;
+  entry.lattice = lattice_name;
+  entry.chain = chain;
+  entry.seed = seed;
+  entry.n_sweeps = n_sweeps;
+  entry.timed = true;
+
+  std::vector<double> ns(n_trials);
+  for (int trial = 0; trial < n_trials; trial++) {
+    lattice.SeedRng(seed);
+    Field field = make();
+    field.HotStart();
+
+    Timer timer;
+    for (int n = 0; n < n_sweeps; n++) sweep(field);
+    timer.Stop();
+    ns[trial] = 1.0e9 * timer.Duration() / (double(n_sweeps) * lattice.n_sites);
+
+    uint64_t hash = ChainHash(field, lattice);
+    if (trial == 0) {
+      entry.hash = hash;
+    } else if (hash != entry.hash) {
+      fprintf(stderr, "FAIL: %s %s seed %d is not deterministic\n",
+              lattice_name.c_str(), chain.c_str(), seed);
+      n_nondeterministic++;
+    }
+  }
+  entry.ns_median = Median(ns);
+  entry.ns_mad = MedianAbsDev(ns);
+
+  fprintf(stderr, "%-16s %-16s %5d %016llx %10.3f %8.3f ns/site-update\n",
+          lattice_name.c_str(), chain.c_str(), seed,
+          (unsigned long long)entry.hash, entry.ns_median, entry.ns_mad);
+  results.push_back(entry);
+}
+
+void Regress::RunLattice(QfeLattice& lattice, const std::string& lattice_name) {
+  int n_threads = this->n_threads;
+  for (int seed : seeds) {
+    lattice.use_counter_rng = false;
+    RunChain<QfeIsing>(
+        lattice, lattice_name, "ising", seed,
+        [&]() { return QfeIsing(&lattice, 0.3); },
+        [](QfeIsing& field) {
+          field.Metropolis();
+          field.WolffUpdate();
+          field.SWUpdate();
+        });
+    RunChain<QfePhi4>(
+        lattice, lattice_name, "phi4", seed,
+        [&]() { return QfePhi4(&lattice, -0.5, 0.25); },
+        [](QfePhi4& field) {
+          field.Metropolis();
+          field.Overrelax();
+          field.WolffUpdate();
+          field.SWUpdate();
+        });
+
+    // the parallel updates must not depend on the number of threads
+    lattice.use_counter_rng = true;
+    RunChain<QfeIsing>(
+        lattice, lattice_name, "ising.parallel", seed,
+        [&]() { return QfeIsing(&lattice, 0.3); },
+        [=](QfeIsing& field) {
+          field.ParallelMetropolis(n_threads);
+          field.ParallelSWUpdate(n_threads);
+        });
+    RunChain<QfePhi4>(
+        lattice, lattice_name, "phi4.parallel", seed,
+        [&]() { return QfePhi4(&lattice, -0.5, 0.25); },
+        [=](QfePhi4& field) {
+          field.ParallelMetropolis(n_threads);
+          field.ParallelOverrelax(n_threads);
+          field.ParallelSWUpdate(n_threads);
+        });
+    lattice.use_counter_rng = false;
+  }
+}
+
+// write the results as a baseline file. without timing, each line only has
+// the first five columns.
+bool Regress::WriteBaseline(const char* path, bool timing) {
+  FILE* file = fopen(path, "w");
+  if (file == nullptr) {
+    fprintf(stderr, "unable to open baseline file %s\n", path);
+    return false;
+  }
+  if (timing) {
+    fprintf(file, "# lattice chain seed n_sweeps hash ns_median ns_mad\n");
+  } else {
+    fprintf(file, "# lattice chain seed n_sweeps hash\n");
+  }
+  for (const RegressEntry& e : results) {
+    fprintf(file, "%s %s %d %d %016llx", e.lattice.c_str(), e.chain.c_str(),
+            e.seed, e.n_sweeps, (unsigned long long)e.hash);
+    if (timing) fprintf(file, " %.6e %.6e", e.ns_median, e.ns_mad);
+    fprintf(file, "\n");
+  }
+  fclose(file);
+  return true;
+}
+
+bool ReadBaseline(const char* path, std::vector<RegressEntry>& baseline) {
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) {
+    fprintf(stderr, "unable to open baseline file %s (record one with "
+            "--write)\n", path);
+    return false;
+  }
+  baseline.clear();
+  char line[1024];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    if (line[0] == '#' || line[0] == '\n') continue;
+    char lattice[256];
+    char chain[256];
+    unsigned long long hash;
+    RegressEntry e;
+    int n_read = sscanf(line, "%255s %255s %d %d %llx %lf %lf", lattice, chain,
+                        &e.seed, &e.n_sweeps, &hash, &e.ns_median, &e.ns_mad);
+    if (n_read != 5 && n_read != 7) {
+      fprintf(stderr, "invalid baseline line: %s", line);
+      fclose(file);
+      return false;
+    }
+    e.timed = (n_read == 7);
+    e.lattice = lattice;
+    e.chain = chain;
+    e.hash = hash;
+    baseline.push_back(e);
+  }
+  fclose(file);
+  return true;
+}
+
+// compare the results with the baseline. a chain is slower if its median time
+// exceeds the baseline median by more than n_sigma standard deviations (the
+// MAD of both is scaled by 1.4826 to estimate the standard deviation of
+// normal noise) and by more than a relative tolerance. returns the number of
+// failures.
+int Regress::Compare(const std::vector<RegressEntry>& baseline,
+                     double n_sigma, double tolerance, bool hash_only) {
+  std::map<std::string, const RegressEntry*> base_map;
+  for (const RegressEntry& e : baseline) {
+    base_map[e.lattice + " " + e.chain + " " + std::to_string(e.seed)] = &e;
+  }
+
+  int n_fail = n_nondeterministic;
+  int n_checked = 0;
+  for (const RegressEntry& e : results) {
+    std::string key = e.lattice + " " + e.chain + " " + std::to_string(e.seed);
+    auto it = base_map.find(key);
+    if (it == base_map.end()) {
+      fprintf(stderr, "FAIL: %s is not in the baseline\n", key.c_str());
+      n_fail++;
+      continue;
+    }
+    const RegressEntry& b = *it->second;
+    n_checked++;
+
+    if (e.n_sweeps != b.n_sweeps) {
+      fprintf(stderr, "FAIL: %s has %d sweeps in the baseline (ran %d)\n",
+              key.c_str(), b.n_sweeps, e.n_sweeps);
+      n_fail++;
+      continue;
+    }
+
+    if (e.hash != b.hash) {
+      fprintf(stderr, "FAIL: %s chain changed (hash %016llx, baseline %016llx)\n",
+              key.c_str(), (unsigned long long)e.hash,
+              (unsigned long long)b.hash);
+      n_fail++;
+    }
+    if (hash_only || !b.timed) continue;
+
+    double sigma = 1.4826 * hypot(e.ns_mad, b.ns_mad);
+    double threshold = std::max(n_sigma * sigma, tolerance * b.ns_median);
+    double change = e.ns_median / b.ns_median - 1.0;
+    if (e.ns_median - b.ns_median > threshold) {
+      fprintf(stderr, "FAIL: %s slower by %+.1f%% (%.3f ns, baseline %.3f ns)\n",
+              key.c_str(), 100.0 * change, e.ns_median, b.ns_median);
+      n_fail++;
+    } else if (b.ns_median - e.ns_median > threshold) {
+      fprintf(stderr, "%s faster by %+.1f%%\n", key.c_str(), 100.0 * change);
+    }
+  }
+
+  if (n_checked < baseline.size()) {
+    fprintf(stderr, "FAIL: %d baseline chains were not run\n",
+            int(baseline.size()) - n_checked);
+    n_fail++;
+  }
+  return n_fail;
+}
+
+int main(int argc, char* argv[]) {
+  int n_trials = 7;
+  int n_sweeps = 20;
+  int n_threads = 0;
+  double n_sigma = 5.0;
+  double tolerance = 0.2;
+  bool hash_only = false;
+  bool write = false;
+
+  const struct option long_options[] = {
+    { "write", no_argument, 0, 'w' },
+    { "hash_only", no_argument, 0, 'H' },
+    { "n_trials", required_argument, 0, 'n' },
+    { "n_sweeps", required_argument, 0, 's' },
+    { "n_threads", required_argument, 0, 't' },
+    { "n_sigma", required_argument, 0, 'k' },
+    { "tolerance", required_argument, 0, 'r' },
+    { 0, 0, 0, 0 }
+  };
+
+  const char* short_options = "wHn:s:t:k:r:";
+
+  while (true) {
+
+    int o = 0;
+    int c = getopt_long(argc, argv, short_options, long_options, &o);
+    if (c == -1) break;
+
+    switch (c) {
+      case 'w': write = true; break;
+      case 'H': hash_only = true; break;
+      case 'n': n_trials = atoi(optarg); break;
+      case 's': n_sweeps = atoi(optarg); break;
+      case 't': n_threads = atoi(optarg); break;
+      case 'k': n_sigma = std::stod(optarg); break;
+      case 'r': tolerance = std::stod(optarg); break;
+      default: break;
+    }
+  }
+
+  if (optind != argc - 1) {
+    fprintf(stderr, "usage: %s [options] baseline_file\n", argv[0]);
+    return 1;
+  }
+  const char* baseline_path = argv[optind];
+
+  // read the baseline first so that a bad path fails immediately
+  std::vector<RegressEntry> baseline;
+  if (!write && !ReadBaseline(baseline_path, baseline)) return 1;
+
+  Regress regress(n_trials, n_sweeps, n_threads);
+
+  QfeLattice rect;
+  rect.InitRect(64, 64, 1.0, 1.0);
+  regress.RunLattice(rect, "rect_64");
+
+  QfeLattice triangle;
+  triangle.InitTriangle(64, 1.0, 1.0, 1.0);
+  regress.RunLattice(triangle, "triangle_64");
+
+  QfeLatticeS2 s2(5, 16);
+  regress.RunLattice(s2, "s2_q5k16");
+
+  QfeLatticeS3 s3(5, 2);
+  regress.RunLattice(s3, "s3_q5k2");
+
+  QfeLatticeAdS2 ads2(6, 7);
+  regress.RunLattice(ads2, "ads2_n6q7");
+
+  QfeLatticeAdS3 ads3(2, 7);
+  regress.RunLattice(ads3, "ads3_n2q7");
+
+  QfeLatticeAdSStrip strip(32, 128);
+  regress.RunLattice(strip, "ads_strip_32");
+
+  if (write) {
+    if (regress.n_nondeterministic) return 1;
+    if (!regress.WriteBaseline(baseline_path, !hash_only)) return 1;
+    printf("wrote %d chains to %s\n", int(regress.results.size()),
+           baseline_path);
+    return 0;
+  }
+
+  int n_fail = regress.Compare(baseline, n_sigma, tolerance, hash_only);
+  if (n_fail) {
+    printf("REGRESSION: %d failures\n", n_fail);
+    return 1;
+  }
+  printf("ok: %d chains match the baseline\n", int(regress.results.size()));
+  return 0;
+}
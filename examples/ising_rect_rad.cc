@@ -254,7 +254,7 @@ int main(int argc, char* argv[]) {
       printf(" %.4f\n", fourier_2pt[k][i].AutocorrBack());
       fprintf(file, "%d %04d %.16e %.16e %d %.16e %.16e\n", k, i, \
           fourier_2pt[k][i].Mean(), fourier_2pt[k][i].Error(), \
-          fourier_2pt[k][i].n, fourier_2pt[k][i].sum, fourier_2pt[k][i].sum2);
+          fourier_2pt[k][i].n, fourier_2pt[k][i].Sum(), fourier_2pt[k][i].Sum2());
     }
   }
   fclose(file);
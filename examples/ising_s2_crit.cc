@@ -249,6 +249,7 @@ int main(int argc, char* argv[]) {
     // printf("%.12f %.12f\n", lattice.links[l0].wt, K);
     lattice.links[l0].wt = K;
   }
+  lattice.UpdateAdjacency();
 
   // calculate spherical harmonics at each site. In all of these loops, (y_l,
   // y_m) are the integer eigenvalues of the spherical harmonics and y_i is a
@@ -374,6 +375,8 @@ int main(int argc, char* argv[]) {
     cluster_size.Measure(double(cluster_size_sum) / vol);
 
     if (n % n_skip || n < n_therm) continue;
+    QFE_PROFILE_SCOPE("measure", "measurements");
+    QFE_PROFILE_WORK(1);
 
     // measure correlators
     std::vector<Complex> ylm_2pt_sum(n_ylm, 0.0);
@@ -425,6 +428,9 @@ int main(int argc, char* argv[]) {
 
   timer.Stop();
   printf("duration: %.6f\n", timer.Duration());
+#ifdef QFE_PROFILE
+  QfeProfiler::Report();
+#endif
 
   printf("cluster_size/V: %.4f\n", cluster_size.Mean());
   printf("accept_metropolis: %.4f\n", accept_metropolis.Mean());
@@ -140,6 +140,7 @@ int main(int argc, char* argv[]) {
     int l = lattice.FindLink(s, sp1);
     lattice.links[l].wt = K4;
   }
+  lattice.UpdateAdjacency();
 
   QfeIsing field(&lattice, beta);
   if (cold_start) {
@@ -17,6 +17,7 @@ class QfeLatticeAdS2 : public QfeLattice {
 public:
   QfeLatticeAdS2(int n_layers, int q);
   virtual void ResizeSites(int n_sites);
+  virtual void PermuteSites(const std::vector<int>& new_index);
   double Sigma(int s1, int s2);
   double Theta(int s1, int s2);
 
@@ -26,6 +27,7 @@ public:
   int n_boundary;  // number of boundary sites
   std::vector<int> layer_size;  // size of each layer
   std::vector<int> layer_offset;  // offset of first site in each layer
+                                  // (cleared by reordering)
 
   std::vector<std::vector<int>> layer_sites;  // list of sites at each layer
   std::vector<int> bulk_sites;  // list of bulk sites
@@ -206,6 +208,37 @@ void QfeLatticeAdS2::ResizeSites(int n_sites) {
   site_layers.resize(n_sites, 0);
 }
 
+/**
+ * @brief Move each site to a new index (see QfeLattice::Reorder). The site
+ * lists keep their order but refer to the new site indices. The layers are no
+ * longer contiguous ranges of sites after reordering, so layer_offset is
+ * cleared; use layer_sites or site_layers instead.
+ */
+
+void QfeLatticeAdS2::PermuteSites(const std::vector<int>& new_index) {
+  QfeLattice::PermuteSites(new_index);
+  PermuteArray(z, new_index);
+  PermuteArray(r, new_index);
+  PermuteArray(theta, new_index);
+  PermuteArray(eps, new_index);
+  PermuteArray(rho, new_index);
+  PermuteArray(u, new_index);
+  PermuteArray(site_layers, new_index);
+
+  for (int n = 0; n < layer_sites.size(); n++) {
+    for (int i = 0; i < layer_sites[n].size(); i++) {
+      layer_sites[n][i] = new_index[layer_sites[n][i]];
+    }
+  }
+  for (int i = 0; i < bulk_sites.size(); i++) {
+    bulk_sites[i] = new_index[bulk_sites[i]];
+  }
+  for (int i = 0; i < boundary_sites.size(); i++) {
+    boundary_sites[i] = new_index[boundary_sites[i]];
+  }
+  layer_offset.clear();
+}
+
 /**
  * @brief Compute the geodesic distance between lattice sites s1 and s2.
  */
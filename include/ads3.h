@@ -10,6 +10,7 @@ class QfeLatticeAdS3 : public QfeLatticeAdS2 {
 public:
   QfeLatticeAdS3(int n_layers, int q, int Nt = 0, double t_scale = 1.0);
   virtual void ResizeSites(int n_sites);
+  virtual void PermuteSites(const std::vector<int>& new_index);
   double Sigma(int s1, int s2);
   double DeltaT(int s1, int s2);
 
@@ -115,6 +116,9 @@ QfeLatticeAdS3::QfeLatticeAdS3(int n_layers, int q, int Nt, double t_scale) :
   for (int s = 0; s < n_sites; s++) {
     AddLink(s, (s + n_sites_slice) % n_sites, t_scale / cosh(rho[s]));
   }
+
+  // link weights have changed
+  adj_valid = false;
 }
 
 /**
@@ -126,6 +130,15 @@ void QfeLatticeAdS3::ResizeSites(int n_sites) {
   t.resize(n_sites);
 }
 
+/**
+ * @brief Move each site to a new index (see QfeLattice::Reorder).
+ */
+
+void QfeLatticeAdS3::PermuteSites(const std::vector<int>& new_index) {
+  QfeLatticeAdS2::PermuteSites(new_index);
+  PermuteArray(t, new_index);
+}
+
 double QfeLatticeAdS3::Sigma(int s1, int s2) {
   if (s1 == s2) return 0.0;
 
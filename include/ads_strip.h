@@ -19,6 +19,7 @@ class QfeLatticeAdSStrip : public QfeLattice {
 public:
   QfeLatticeAdSStrip(int n_rho, int n_t, double t_scale = 1.0);
   virtual void ResizeSites(int n_sites);
+  virtual void PermuteSites(const std::vector<int>& new_index);
 
   double t_scale = 1.0;
 
@@ -77,3 +78,12 @@ void QfeLatticeAdSStrip::ResizeSites(int n_sites) {
   QfeLattice::ResizeSites(n_sites);
   rho.resize(n_sites);
 }
+
+/**
+ * @brief Move each site to a new index (see QfeLattice::Reorder).
+ */
+
+void QfeLatticeAdSStrip::PermuteSites(const std::vector<int>& new_index) {
+  QfeLattice::PermuteSites(new_index);
+  PermuteArray(rho, new_index);
+}
@@ -0,0 +1,137 @@
+// exact.h
+
+#pragma once
+
+#include <Eigen/Dense>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "lattice.h"
+
+/// @brief Exact expectation values on small lattices, for validating the
+/// Monte Carlo update kernels. The observables use the same normalization as
+/// the field classes, i.e. the action is the total action divided by the
+/// lattice volume, and m is the site-weighted mean field.
+class QfeExact {
+ public:
+  QfeExact();
+  void Ising(QfeLattice* lattice, double beta);
+  void Gaussian(QfeLattice* lattice, double msq);
+  double U4();
+
+  double action;  // <S> / vol
+  double mag;     // <|m|>
+  double mag2;    // <m^2>
+  double mag4;    // <m^4>
+};
+
+QfeExact::QfeExact() {
+  action = 0.0;
+  mag = 0.0;
+  mag2 = 0.0;
+  mag4 = 0.0;
+}
+
+/// @brief Ising model expectation values by exact enumeration of all 2^n
+/// spin configurations (n = number of sites, at most 30). The configurations
+/// are visited in Gray code order, so that each one differs from the previous
+/// by a single spin flip. Link weights may be arbitrary.
+/// @param lattice Lattice (small)
+/// @param beta Bare coupling
+void QfeExact::Ising(QfeLattice* lattice, double beta) {
+  int n_sites = lattice->n_sites;
+  assert(n_sites <= 30);
+  lattice->SyncAdjacency();
+  const int* adj_offset = lattice->adj_offset.data();
+  const int* adj_sites = lattice->adj_sites.data();
+  const double* adj_wt = lattice->adj_wt.data();
+
+  // start with all spins up. the bond sum is shifted by its maximum value so
+  // that the boltzmann weights can't overflow.
+  std::vector<int> spin(n_sites, 1);
+  double bond_sum = 0.0;
+  double bond_max = 0.0;
+  double mag_sum = 0.0;
+  for (int s = 0; s < n_sites; s++) {
+    for (int i = adj_offset[s]; i < adj_offset[s + 1]; i++) {
+      bond_sum += 0.5 * adj_wt[i];
+      bond_max += 0.5 * fabs(adj_wt[i]);
+    }
+    mag_sum += lattice->sites[s].wt;
+  }
+
+  double z = 0.0;
+  double bond_z = 0.0;
+  double mag_z = 0.0;
+  double mag2_z = 0.0;
+  double mag4_z = 0.0;
+  uint64_t n_configs = uint64_t(1) << n_sites;
+  for (uint64_t c = 0; c < n_configs; c++) {
+    if (c != 0) {
+      // flip the lowest set bit of c
+      int s = 0;
+      while (!((c >> s) & 1)) s++;
+      double spin_sum = 0.0;
+      for (int i = adj_offset[s]; i < adj_offset[s + 1]; i++) {
+        spin_sum += spin[adj_sites[i]] * adj_wt[i];
+      }
+      bond_sum -= 2.0 * spin[s] * spin_sum;
+      mag_sum -= 2.0 * spin[s] * lattice->sites[s].wt;
+      spin[s] = -spin[s];
+    }
+
+    double w = exp(beta * (bond_sum - bond_max));
+    double m = mag_sum / lattice->vol;
+    double m2 = m * m;
+    z += w;
+    bond_z += w * bond_sum;
+    mag_z += w * fabs(m);
+    mag2_z += w * m2;
+    mag4_z += w * m2 * m2;
+  }
+
+  action = -beta * bond_z / z / lattice->vol;
+  mag = mag_z / z;
+  mag2 = mag2_z / z;
+  mag4 = mag4_z / z;
+}
+
+/// @brief Expectation values of the free scalar field, i.e. QfePhi4 with
+/// lambda = 0 and no mass counterterms. The action is S = phi^T K phi / 2,
+/// so <phi_a phi_b> = (K^-1)_ab, the action of each mode is 1/2, and m is
+/// gaussian. K is inverted directly, so the lattice should be small.
+/// @param lattice Lattice (small)
+/// @param msq Bare mass squared (must be positive)
+void QfeExact::Gaussian(QfeLattice* lattice, double msq) {
+  int n_sites = lattice->n_sites;
+  Eigen::MatrixXd K = Eigen::MatrixXd::Zero(n_sites, n_sites);
+  for (int l = 0; l < lattice->n_links; l++) {
+    int a = lattice->links[l].sites[0];
+    int b = lattice->links[l].sites[1];
+    double wt = lattice->links[l].wt;
+    K(a, a) += wt;
+    K(b, b) += wt;
+    K(a, b) -= wt;
+    K(b, a) -= wt;
+  }
+  Eigen::VectorXd site_wt(n_sites);
+  for (int s = 0; s < n_sites; s++) {
+    site_wt(s) = lattice->sites[s].wt;
+    K(s, s) += msq * site_wt(s);
+  }
+
+  Eigen::LLT<Eigen::MatrixXd> llt(K);
+  assert(llt.info() == Eigen::Success);
+  double vol = lattice->vol;
+  action = 0.5 * n_sites / vol;
+  mag2 = site_wt.dot(llt.solve(site_wt)) / (vol * vol);
+  mag4 = 3.0 * mag2 * mag2;
+  mag = sqrt(2.0 * mag2 / M_PI);
+}
+
+/// @brief 4th order Binder cumulant, normalized as in the examples
+double QfeExact::U4() {
+  return 1.5 * (1.0 - mag4 / (3.0 * mag2 * mag2));
+}
@@ -2,18 +2,26 @@
 
 #pragma once
 
+#include <cassert>
 #include <cmath>
+#include <climits>
+#include <cstdint>
+#include <random>
 #include <stack>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 #include "lattice.h"
+#include "parallel.h"
+#include "statistics.h"
+#include "timer.h"
 
 /// @brief Ising spin model
 class QfeIsing {
  public:
   QfeIsing(QfeLattice* lattice, double beta);
+  void SetRng(QfeChainRng* chain_rng);
   void WriteField(FILE* file);
   void ReadField(FILE* file);
   double Action();
@@ -21,17 +29,47 @@ class QfeIsing {
   void HotStart();
   void ColdStart();
   double Metropolis();
+  double ParallelMetropolis(int n_threads = 0);
   int WolffUpdate();
   int SWUpdate();
+  int ParallelSWUpdate(int n_threads = 0);
   int FindSWRoot(int s);
+  void UpdateBondProb();
+  void StartTracking(int interval = 1000);
+  void StopTracking();
+  void SyncTracking();
+  void CountTrackedUpdate();
+  double TrackedAction();
+  double TrackedMeanSpin();
+  double ClusterSusceptibility();
+  double SWClusterSusceptibility();
+  template <typename Bin>
+  void MeasureClusterCorrelator(Bin bin, std::vector<QfeMeasReal>& corr);
 
   QfeLattice* lattice;
+  QfeChainRng* chain_rng;    // random number generators (lattice by default)
   std::vector<double> spin;  // Z2 field
   double beta;               // bare coupling
 
-  std::vector<bool> is_clustered;  // keeps track of which sites are clustered
+  // running totals maintained by the updates (if tracking is true)
+  bool tracking;        // maintain the running totals
+  int track_interval;   // updates between exact recalculations
+  int track_count;      // updates since the last exact recalculation
+  double track_mag;     // sum of spin * site weight
+  double track_action;  // total action (not divided by the volume)
+
+  std::vector<double> rand_buf;  // random numbers for one metropolis sweep
+
+  std::vector<int> cluster_stamp;  // site is clustered if equal to cluster_gen
+  int cluster_gen;                 // current wolff cluster generation
+  std::vector<int> cluster_stack;  // sites waiting to be processed
   std::vector<int> wolff_cluster;  // array of clustered sites
   std::vector<int> sw_root;        // root for each site
+  std::vector<char> sw_flip;       // flip each cluster (indexed by root)
+
+  std::vector<double> adj_p_bond;  // bond probability for each adjacency entry
+  double p_bond_beta;              // beta used for adj_p_bond
+  int p_bond_version;              // lattice adjacency version for adj_p_bond
 };
 
 /// @brief Ising model constructor
@@ -39,16 +77,37 @@ class QfeIsing {
 /// @param beta spin coupling coefficient (use link weights for local couplings)
 QfeIsing::QfeIsing(QfeLattice* lattice, double beta) {
   this->lattice = lattice;
+  chain_rng = lattice;
   this->beta = beta;
   spin.resize(lattice->n_sites);
-  is_clustered.resize(lattice->n_sites);
+  cluster_stamp.resize(lattice->n_sites, 0);
+  cluster_gen = 0;
+  cluster_stack.resize(lattice->n_sites);
   sw_root.resize(lattice->n_sites);
+  p_bond_beta = NAN;
+  p_bond_version = -1;
+  tracking = false;
+  track_interval = 1000;
+  track_count = 0;
+  track_mag = 0.0;
+  track_action = 0.0;
+}
+
+/// @brief Use a separate set of random number generators instead of the
+/// lattice's own. Fields with their own generators can be updated
+/// concurrently on the same lattice, as long as the lattice is not modified
+/// (call SyncAdjacency and SyncColoring first).
+/// @param chain_rng Generators for this field (must outlive the field)
+void QfeIsing::SetRng(QfeChainRng* chain_rng) {
+  this->chain_rng = chain_rng;
 }
 
 /// @brief Write the Ising spins to a data file. Each spin value is packed into
 /// a single bit to reduce file size.
 /// @param file Data file
 void QfeIsing::WriteField(FILE* file) {
+  QFE_PROFILE_SCOPE("QfeIsing::WriteField", "bytes");
+  QFE_PROFILE_WORK((spin.size() + 7) / 8);
   int buf_size = (spin.size() + 7) / 8;
   std::vector<unsigned char> spin_buf(buf_size, 0);
 
@@ -67,6 +126,8 @@ void QfeIsing::WriteField(FILE* file) {
 /// @brief Read the Ising spins from a data file
 /// @param file Data file
 void QfeIsing::ReadField(FILE* file) {
+  QFE_PROFILE_SCOPE("QfeIsing::ReadField", "bytes");
+  QFE_PROFILE_WORK((spin.size() + 7) / 8);
   int buf_size = (spin.size() + 7) / 8;
   std::vector<unsigned char> spin_buf(buf_size, 0);
   fread(spin_buf.data(), 1, buf_size, file);
@@ -80,19 +141,25 @@ void QfeIsing::ReadField(FILE* file) {
     mask <<= 1;
     if (!mask) mask = 1;
   }
+  if (tracking) SyncTracking();
 }
 
 /// @brief Calculate the Ising model action
 /// @return The action per spin
 double QfeIsing::Action() {
+  lattice->SyncAdjacency();
+  const int* adj_offset = lattice->adj_offset.data();
+  const int* adj_sites = lattice->adj_sites.data();
+  const double* adj_wt = lattice->adj_wt.data();
   double action = 0.0;
 
-  // sum over links
-  for (int l = 0; l < lattice->n_links; l++) {
-    QfeLink* link = &lattice->links[l];
-    int a = link->sites[0];
-    int b = link->sites[1];
-    action -= beta * spin[a] * spin[b] * link->wt;
+  // sum over links (each link is visited once from each end)
+  for (int s = 0; s < lattice->n_sites; s++) {
+    double spin_sum = 0.0;
+    for (int i = adj_offset[s]; i < adj_offset[s + 1]; i++) {
+      spin_sum += spin[adj_sites[i]] * adj_wt[i];
+    }
+    action -= 0.5 * beta * spin[s] * spin_sum;
   }
 
   return action / lattice->vol;
@@ -111,88 +178,178 @@ double QfeIsing::MeanSpin() {
 /// @brief Randomize all spins
 void QfeIsing::HotStart() {
   for (int s = 0; s < lattice->n_sites; s++) {
-    if (lattice->rng.RandBool()) {
+    if (chain_rng->rng.RandBool()) {
       spin[s] = 1.0;
     } else {
       spin[s] = -1.0;
     }
   }
+  if (tracking) SyncTracking();
 }
 
 /// @brief Set all spins to +1
-void QfeIsing::ColdStart() { std::fill(spin.begin(), spin.end(), 1.0); }
+void QfeIsing::ColdStart() {
+  std::fill(spin.begin(), spin.end(), 1.0);
+  if (tracking) SyncTracking();
+}
 
 /// @brief Metropolis update algorithm (i.e. Rosenbluth-Teller)
 /// ref: N. Metropolis, et al., J. Chem. Phys. 21, 1087 (1953).
 /// @return The acceptance rate
 double QfeIsing::Metropolis() {
+  QFE_PROFILE_SCOPE("QfeIsing::Metropolis", "site-updates");
+  QFE_PROFILE_WORK(lattice->n_sites);
+  lattice->SyncAdjacency();
+  const int* adj_offset = lattice->adj_offset.data();
+  const int* adj_sites = lattice->adj_sites.data();
+  const double* adj_wt = lattice->adj_wt.data();
+
+  // draw the random numbers for the whole sweep at once
+  rand_buf.resize(lattice->n_sites);
+  chain_rng->rng.FillReal(rand_buf.data(), lattice->n_sites);
+
   int accept = 0;
   for (int s = 0; s < lattice->n_sites; s++) {
     double delta_S = 0.0;
 
     // sum over links connected to this site
-    QfeSite* site = &lattice->sites[s];
-    for (int n = 0; n < site->nn; n++) {
-      int l = site->links[n];
-      double link_wt = lattice->links[l].wt;
-      delta_S += beta * spin[site->neighbors[n]] * link_wt;
+    for (int i = adj_offset[s]; i < adj_offset[s + 1]; i++) {
+      delta_S += beta * spin[adj_sites[i]] * adj_wt[i];
     }
     delta_S *= 2.0 * spin[s];
 
     // metropolis algorithm
-    if (delta_S <= 0.0 || lattice->rng.RandReal() < exp(-delta_S)) {
+    if (delta_S <= 0.0 || rand_buf[s] < exp(-delta_S)) {
+      if (tracking) {
+        track_action += delta_S;
+        track_mag -= 2.0 * spin[s] * lattice->sites[s].wt;
+      }
       spin[s] *= -1.0;
       accept++;
     }
   }
+  if (tracking) CountTrackedUpdate();
   return double(accept) / double(lattice->n_sites);
 }
 
-/// @brief Wolff cluster update algorithm
+/// @brief Metropolis update algorithm, run in parallel one site color at a
+/// time (see QfeLattice::ColorSweep). The result does not depend on the number
+/// of threads, but differs from the sequential Metropolis sweep.
+/// @param n_threads Number of threads (0 for one per core)
+/// @return The acceptance rate
+double QfeIsing::ParallelMetropolis(int n_threads) {
+  QFE_PROFILE_SCOPE("QfeIsing::ParallelMetropolis", "site-updates");
+  QFE_PROFILE_WORK(lattice->n_sites);
+  lattice->SyncAdjacency();
+  const int* adj_offset = lattice->adj_offset.data();
+  const int* adj_sites = lattice->adj_sites.data();
+  const double* adj_wt = lattice->adj_wt.data();
+
+  auto kernel = [&](int s, int b, auto& rng) {
+    double delta_S = 0.0;
+
+    // sum over links connected to this site
+    for (int i = adj_offset[s]; i < adj_offset[s + 1]; i++) {
+      delta_S += beta * spin[adj_sites[i]] * adj_wt[i];
+    }
+    delta_S *= 2.0 * spin[s];
+
+    // metropolis algorithm
+    if (delta_S <= 0.0 || rng.RandReal() < exp(-delta_S)) {
+      spin[s] *= -1.0;
+      return 1;
+    }
+    return 0;
+  };
+
+  int accept = lattice->ColorSweep(kernel, n_threads, chain_rng);
+  if (tracking) SyncTracking();
+  return double(accept) / double(lattice->n_sites);
+}
+
+/// @brief Compute the probability 1 - exp(-2 beta w) of adding each link to
+/// a cluster when the spins at its ends are aligned. Links with beta w <= 0
+/// never join a cluster. This is done automatically when beta or the lattice
+/// adjacency changes.
+void QfeIsing::UpdateBondProb() {
+  lattice->SyncAdjacency();
+  int n_adj = lattice->adj_wt.size();
+  adj_p_bond.resize(n_adj);
+  for (int i = 0; i < n_adj; i++) {
+    double beta_wt = beta * lattice->adj_wt[i];
+    adj_p_bond[i] = (beta_wt > 0.0) ? -expm1(-2.0 * beta_wt) : 0.0;
+  }
+  p_bond_beta = beta;
+  p_bond_version = lattice->adj_version;
+}
+
+/// @brief Wolff cluster update algorithm. Clustered sites are marked with a
+/// generation stamp and the bond probabilities are precomputed, so the cost is
+/// proportional to the size of the cluster and its boundary.
 /// ref: U. Wolff, Phys. Rev. Lett. 62, 361 (1989).
 /// @return Cluster size
 int QfeIsing::WolffUpdate() {
-  // remove all sites from the cluster
-  std::fill(is_clustered.begin(), is_clustered.end(), false);
+  QFE_PROFILE_SCOPE("QfeIsing::WolffUpdate", "cluster-sites");
+  lattice->SyncAdjacency();
+  if (!(p_bond_beta == beta) || p_bond_version != lattice->adj_version) {
+    UpdateBondProb();
+  }
+  const int* adj_offset = lattice->adj_offset.data();
+  const int* adj_sites = lattice->adj_sites.data();
+  const double* adj_wt = lattice->adj_wt.data();
+  const double* adj_p_bond = this->adj_p_bond.data();
+
+  // start a new cluster generation (all sites become unclustered)
+  if (cluster_gen == INT_MAX) {
+    std::fill(cluster_stamp.begin(), cluster_stamp.end(), 0);
+    cluster_gen = 0;
+  }
+  cluster_gen++;
+  int* stamp = cluster_stamp.data();
+  int* stack = cluster_stack.data();
+  int stack_size = 0;
   wolff_cluster.clear();
 
-  // create the stack
-  std::stack<int> stack;
-
   // choose a random site and add it to the cluster
-  int s = lattice->rng.RandInt(0, lattice->n_sites - 1);
+  int s = chain_rng->rng.RandInt(0, lattice->n_sites - 1);
   wolff_cluster.push_back(s);
-  is_clustered[s] = true;
-  stack.push(s);
+  stamp[s] = cluster_gen;
+  stack[stack_size++] = s;
 
-  while (stack.size() != 0) {
-    s = stack.top();
-    stack.pop();
+  while (stack_size != 0) {
+    s = stack[--stack_size];
 
     // flip the spin
     double value = spin[s];
     spin[s] = -value;
 
     // try to add neighbors
-    QfeSite* site = &lattice->sites[s];
-    for (int n = 0; n < site->nn; n++) {
-      int l = site->links[n];
-      double link_wt = lattice->links[l].wt;
-      s = site->neighbors[n];
+    double spin_sum = 0.0;  // neighbor spins (for tracking the action)
+    int i_end = adj_offset[s + 1];
+    for (int i = adj_offset[s]; i < i_end; i++) {
+      int s_n = adj_sites[i];
+      spin_sum += spin[s_n] * adj_wt[i];
 
       // skip if the site is already clustered
-      if (is_clustered[s]) continue;
+      if (stamp[s_n] == cluster_gen) continue;
 
       // check if link is clustered
-      double rate = -2.0 * beta * value * spin[s] * link_wt;
-      if (rate >= 0.0 || lattice->rng.RandReal() < exp(rate)) continue;
+      if (value * spin[s_n] * adj_wt[i] <= 0.0) continue;
+      if (chain_rng->rng.RandReal() >= adj_p_bond[i]) continue;
+
+      wolff_cluster.push_back(s_n);
+      stamp[s_n] = cluster_gen;
+      stack[stack_size++] = s_n;
+    }
 
-      wolff_cluster.push_back(s);
-      is_clustered[s] = true;
-      stack.push(s);
+    if (tracking) {
+      track_action += 2.0 * beta * value * spin_sum;
+      track_mag -= 2.0 * value * lattice->sites[s].wt;
     }
   }
 
+  if (tracking) CountTrackedUpdate();
+  QFE_PROFILE_WORK(wolff_cluster.size());
   return wolff_cluster.size();
 }
 
@@ -200,6 +357,8 @@ int QfeIsing::WolffUpdate() {
 /// ref: R.H. Swendsen and J.S. Wang, Phys. Rev. Lett. 58, 86 (1987)
 /// @return The total number of clusters
 int QfeIsing::SWUpdate() {
+  QFE_PROFILE_SCOPE("QfeIsing::SWUpdate", "site-updates");
+  QFE_PROFILE_WORK(lattice->n_sites);
   // each site begins in its own cluster
   std::iota(std::begin(sw_root), std::end(sw_root), 0);
 
@@ -211,7 +370,7 @@ int QfeIsing::SWUpdate() {
 
     // check if link is clustered
     double rate = -2.0 * beta * spin[s1] * spin[s2] * link_wt;
-    if (rate >= 0.0 || lattice->rng.RandReal() < exp(rate)) continue;
+    if (rate >= 0.0 || chain_rng->rng.RandReal() < exp(rate)) continue;
 
     // find the root node for each site
     int r1 = FindSWRoot(s1);
@@ -223,25 +382,102 @@ int QfeIsing::SWUpdate() {
     sw_root[r2] = r;
   }
 
-  std::unordered_map<int, int> sw_map;
-  std::vector<bool> is_flipped;
+  // the root of each cluster is its smallest site, so it is the first site
+  // of the cluster to be visited here
+  sw_flip.resize(lattice->n_sites);
   int n_clusters = 0;
   for (int s = 0; s < lattice->n_sites; s++) {
     // find the root node for this site
     int r = FindSWRoot(s);
-
-    if (sw_map.find(r) == sw_map.end()) {
-      sw_map[r] = n_clusters;
-      is_flipped.push_back(lattice->rng.RandReal() > 0.5);
+    if (r == s) {
+      sw_flip[s] = chain_rng->rng.RandReal() > 0.5;
       n_clusters++;
     }
 
-    int c = sw_map[r];
-
     // flip half the clusters
-    if (is_flipped[c]) spin[s] = -spin[s];
+    if (sw_flip[r]) spin[s] = -spin[s];
   }
 
+  if (tracking) SyncTracking();
+  return n_clusters;
+}
+
+/// @brief Swendsen-Wang update run on @p n_threads threads. Bonds are activated
+/// in parallel using the counter-based generator (QfeChainRng::counter_rng,
+/// one stream per link), clusters are merged with a lock-free union-find whose
+/// roots are always the smallest site in each cluster, and each cluster is
+/// flipped using the stream of its root site. The result is therefore the
+/// same for any number of threads. counter_rng.sweep is advanced by one.
+/// @param n_threads Number of threads (0 for one per core)
+/// @return The total number of clusters
+int QfeIsing::ParallelSWUpdate(int n_threads) {
+  QFE_PROFILE_SCOPE("QfeIsing::ParallelSWUpdate", "site-updates");
+  QFE_PROFILE_WORK(lattice->n_sites);
+  const QfeCounterRng& crng = chain_rng->counter_rng;
+  uint64_t sweep = chain_rng->counter_rng.sweep++;
+  lattice->SyncAdjacency();
+  const int* adj_offset = lattice->adj_offset.data();
+  const int* adj_sites = lattice->adj_sites.data();
+  const int* adj_links = lattice->adj_links.data();
+  const double* adj_wt = lattice->adj_wt.data();
+  int n_sites = lattice->n_sites;
+  int n_links = lattice->n_links;
+  int* root = sw_root.data();
+  sw_flip.resize(n_sites);
+
+  // each site begins in its own cluster
+  ParallelFor(n_sites, n_threads, [&](int s_begin, int s_end, int t) {
+    for (int s = s_begin; s < s_end; s++) root[s] = s;
+  });
+
+  // activate bonds and merge clusters. each link is handled from the end with
+  // the smaller index, using the stream of that link.
+  ParallelFor(n_sites, n_threads, [&](int s_begin, int s_end, int t) {
+    for (int s = s_begin; s < s_end; s++) {
+      for (int i = adj_offset[s]; i < adj_offset[s + 1]; i++) {
+        int s_n = adj_sites[i];
+        if (s_n < s) continue;
+
+        // check if link is clustered
+        double rate = -2.0 * beta * spin[s] * spin[s_n] * adj_wt[i];
+        if (rate >= 0.0) continue;
+        QfeRngStream rng(crng, sweep, adj_links[i]);
+        if (rng.RandReal() < exp(rate)) continue;
+
+        ConcurrentUnion(root, s, s_n);
+      }
+    }
+  });
+
+  // decide which clusters to flip
+  std::vector<int> thread_clusters(NumThreads(n_threads), 0);
+  ParallelFor(n_sites, n_threads, [&](int s_begin, int s_end, int t) {
+    for (int s = s_begin; s < s_end; s++) {
+      if (__atomic_load_n(&root[s], __ATOMIC_RELAXED) != s) continue;
+      QfeRngStream rng(crng, sweep, uint64_t(n_links) + s);
+      sw_flip[s] = rng.RandBool();
+      thread_clusters[t]++;
+    }
+  });
+
+  // flip half the clusters, and point every site directly at its root (as
+  // SWUpdate does) for SWClusterSusceptibility. the forest is only modified
+  // by the atomic path halving in ConcurrentFindRoot and by these stores,
+  // which never change any root. a halving step on root[s] that races with
+  // the store either fails or also sets it to the root.
+  ParallelFor(n_sites, n_threads, [&](int s_begin, int s_end, int t) {
+    for (int s = s_begin; s < s_end; s++) {
+      int r = ConcurrentFindRoot(root, s);
+      __atomic_store_n(&root[s], r, __ATOMIC_RELAXED);
+      if (sw_flip[r]) spin[s] = -spin[s];
+    }
+  });
+  if (tracking) SyncTracking();
+
+  int n_clusters = 0;
+  for (int t = 0; t < thread_clusters.size(); t++) {
+    n_clusters += thread_clusters[t];
+  }
   return n_clusters;
 }
 
@@ -264,3 +500,446 @@ int QfeIsing::FindSWRoot(int s) {
 
   return root;
 }
+
+/// @brief Start maintaining running totals of the magnetization and action.
+/// Metropolis and Wolff updates change the totals by the amount they already
+/// compute for each flipped spin, so TrackedAction and TrackedMeanSpin can be
+/// measured after every update at no cost. Updates that change the whole field
+/// anyway (Swendsen-Wang, parallel sweeps, hot/cold starts, reading a field)
+/// recompute the totals exactly. The totals are also recomputed after every
+/// @p interval tracked updates to bound the accumulated rounding error. Call
+/// SyncTracking after changing beta or the link weights.
+/// @param interval Number of updates between exact recalculations
+void QfeIsing::StartTracking(int interval) {
+  tracking = true;
+  track_interval = interval;
+  SyncTracking();
+}
+
+/// @brief Stop maintaining running totals
+void QfeIsing::StopTracking() { tracking = false; }
+
+/// @brief Recompute the running totals exactly
+void QfeIsing::SyncTracking() {
+  track_action = Action() * lattice->vol;
+  track_mag = MeanSpin() * lattice->vol;
+  track_count = 0;
+}
+
+/// @brief Count one tracked update and recompute the running totals if the
+/// recalculation interval has been reached
+void QfeIsing::CountTrackedUpdate() {
+  track_count++;
+  if (track_count >= track_interval) SyncTracking();
+}
+
+/// @brief Tracked value of the action (see StartTracking)
+/// @return The action per spin
+double QfeIsing::TrackedAction() { return track_action / lattice->vol; }
+
+/// @brief Tracked value of the mean spin (see StartTracking)
+/// @return The mean spin (i.e. magnetization)
+double QfeIsing::TrackedMeanSpin() { return track_mag / lattice->vol; }
+
+/// @brief Improved estimator for the susceptibility from the last Wolff
+/// cluster. The seed site is chosen uniformly, so a cluster C with total site
+/// weight W_C contributes n_sites * W_C^2 / |C| to the weighted square
+/// magnetization. Averaging this value gives the same result as averaging
+/// vol * MeanSpin()^2, but with a much smaller variance near the critical
+/// point.
+/// @return Estimate of vol * <m^2>
+double QfeIsing::ClusterSusceptibility() {
+  double cluster_wt = 0.0;
+  for (int s : wolff_cluster) cluster_wt += lattice->sites[s].wt;
+  double n_sites = double(lattice->n_sites);
+  double n_cluster = double(wolff_cluster.size());
+  return n_sites * cluster_wt * cluster_wt / (n_cluster * lattice->vol);
+}
+
+/// @brief Improved estimator for the susceptibility from the clusters of the
+/// last Swendsen-Wang update. Every cluster C with total site weight W_C
+/// contributes W_C^2 to the weighted square magnetization.
+/// @return Estimate of vol * <m^2>
+double QfeIsing::SWClusterSusceptibility() {
+  std::vector<double> root_wt(lattice->n_sites, 0.0);
+  for (int s = 0; s < lattice->n_sites; s++) {
+    root_wt[sw_root[s]] += lattice->sites[s].wt;
+  }
+  double sum = 0.0;
+  for (int s = 0; s < lattice->n_sites; s++) {
+    sum += root_wt[s] * root_wt[s];
+  }
+  return sum / lattice->vol;
+}
+
+/// @brief Measure the cluster-connected two-point function from the last
+/// Wolff cluster. Two sites are correlated only if they are in the same
+/// cluster, so each pair of sites s1, s2 in the cluster contributes
+/// n_sites / |C| * wt(s1) * wt(s2) / vol to the bin returned by bin(s1, s2).
+/// The average of corr[b] is the sum of wt(s1) * wt(s2) * <s1 s2> / vol over
+/// all pairs of sites in bin b, which for a flat lattice is the translation
+/// averaged correlator. The bin will usually depend on the distance between
+/// the sites, e.g. CosTheta on a sphere or Sigma on AdS. Pairs with a bin
+/// outside [0, corr.size()) are skipped. The cost is proportional to |C|^2.
+/// @param bin Function that returns the bin for a pair of sites
+/// @param corr Measurement for each bin
+template <typename Bin>
+void QfeIsing::MeasureClusterCorrelator(Bin bin,
+                                        std::vector<QfeMeasReal>& corr) {
+  int n_bins = corr.size();
+  std::vector<double> corr_sum(n_bins, 0.0);
+  for (int s1 : wolff_cluster) {
+    double wt1 = lattice->sites[s1].wt;
+    for (int s2 : wolff_cluster) {
+      int b = bin(s1, s2);
+      if (b < 0 || b >= n_bins) continue;
+      corr_sum[b] += wt1 * lattice->sites[s2].wt;
+    }
+  }
+
+  double norm = double(lattice->n_sites) /
+                (double(wolff_cluster.size()) * lattice->vol);
+  for (int b = 0; b < n_bins; b++) {
+    corr[b].Measure(corr_sum[b] * norm);
+  }
+}
+
+// maximum number of distinct link weights for the multi-spin coded engine
+#define MAX_MSC_CLASSES 4
+
+/// @brief Multi-spin coded Ising model. Each site stores the spins of 64
+/// independent replicas as the bits of a single word (a set bit is spin -1),
+/// and a Metropolis sweep updates all 64 replicas at once using bitwise
+/// arithmetic. Links are grouped into classes of equal weight, so this is
+/// intended for lattices with only a few distinct link weights, such as the
+/// flat lattices made by InitRect and InitTriangle. On lattices with more than
+/// MAX_MSC_CLASSES distinct link weights (e.g. S2 or S3 after UpdateWeights),
+/// multi_spin is false and Metropolis falls back to updating the replicas one
+/// at a time, which gives the same distribution at the cost of an ordinary
+/// update per replica. The fallback is reported on stderr when the classes are
+/// built, and callers can check multi_spin (or the result of UpdateSiteTypes).
+/// ref: M. Creutz, et al., Phys. Rev. Lett. 42, 1390 (1979).
+class QfeIsingMultiSpin {
+ public:
+  QfeIsingMultiSpin(QfeLattice* lattice, double beta);
+  void SetRng(QfeChainRng* chain_rng);
+  bool UpdateSiteTypes();
+  double Action(int r);
+  double MeanSpin(int r);
+  void HotStart();
+  void ColdStart();
+  double Metropolis();
+  double ReplicaMetropolis();
+  void GetReplica(int r, QfeIsing& field);
+  void SetReplica(int r, QfeIsing& field);
+
+  /// @brief Possible Metropolis outcome at a site: the number of anti-aligned
+  /// neighbors in each link class and the probability of flipping
+  struct Outcome {
+    int n_anti[MAX_MSC_CLASSES];  // anti-aligned neighbors in each class
+    bool always_flip;             // true if delta_S <= 0
+    uint32_t threshold;           // flip probability * 2^32
+  };
+
+  QfeLattice* lattice;
+  QfeChainRng* chain_rng;      // seeds gen (lattice by default)
+  std::vector<uint64_t> spin;  // Z2 field for 64 replicas
+  double beta;                 // bare coupling
+
+  bool multi_spin;  // link weights fit in MAX_MSC_CLASSES classes
+  int n_classes;                       // number of distinct link weights
+  std::vector<double> class_wt;        // link weight of each class
+  std::vector<int> adj_class;          // class of each adjacency entry
+  std::vector<int> site_type;          // type of each site
+  std::vector<std::vector<Outcome>> type_outcomes;  // outcomes for each type
+  std::vector<double> type_wt_sum;     // total link weight for each type
+  double outcome_beta;  // beta used to compute the thresholds
+  std::mt19937_64 gen;  // generator for random bit masks
+};
+
+/// @brief Multi-spin coded Ising model constructor
+/// @param lattice The Ising spins are defined on the lattice sites
+/// @param beta spin coupling coefficient (use link weights for local couplings)
+QfeIsingMultiSpin::QfeIsingMultiSpin(QfeLattice* lattice, double beta) {
+  this->lattice = lattice;
+  this->beta = beta;
+  spin.resize(lattice->n_sites, 0);
+  SetRng(lattice);
+  UpdateSiteTypes();
+}
+
+/// @brief Reseed the random bit generator from a chain's generators, e.g. to
+/// run independent multi-spin chains on one lattice with QfeChainRunner
+/// @param chain_rng Chain random number generators
+void QfeIsingMultiSpin::SetRng(QfeChainRng* chain_rng) {
+  this->chain_rng = chain_rng;
+  gen.seed(chain_rng->rng.gen());
+}
+
+/// @brief Group the links into classes of equal weight, and the sites into
+/// types with the same number of neighbors in each class. Then list the
+/// possible outcomes of a Metropolis update for each type. This must be called
+/// again if the link weights change.
+/// @return False if there are more than MAX_MSC_CLASSES link weights, in which
+/// case the replicas are updated one at a time
+bool QfeIsingMultiSpin::UpdateSiteTypes() {
+  lattice->SyncAdjacency();
+  const std::vector<int>& adj_offset = lattice->adj_offset;
+
+  // find the distinct link weights
+  class_wt.clear();
+  adj_class.resize(lattice->adj_wt.size());
+  for (int i = 0; i < adj_class.size(); i++) {
+    double wt = lattice->adj_wt[i];
+    int c = std::find(class_wt.begin(), class_wt.end(), wt) - class_wt.begin();
+    if (c == class_wt.size()) class_wt.push_back(wt);
+    adj_class[i] = c;
+  }
+  n_classes = class_wt.size();
+  multi_spin = (n_classes <= MAX_MSC_CLASSES);
+  if (!multi_spin) {
+    fprintf(stderr,
+            "QfeIsingMultiSpin: %d distinct link weights (max %d), updating "
+            "replicas one at a time\n",
+            n_classes, MAX_MSC_CLASSES);
+    site_type.clear();
+    type_outcomes.clear();
+    type_wt_sum.clear();
+    return false;
+  }
+
+  // find the distinct numbers of neighbors in each class
+  std::vector<std::vector<int>> type_n_nb;
+  site_type.resize(lattice->n_sites);
+  for (int s = 0; s < lattice->n_sites; s++) {
+    std::vector<int> n_nb(n_classes, 0);
+    for (int i = adj_offset[s]; i < adj_offset[s + 1]; i++) {
+      n_nb[adj_class[i]]++;
+    }
+    int t = std::find(type_n_nb.begin(), type_n_nb.end(), n_nb) -
+            type_n_nb.begin();
+    if (t == type_n_nb.size()) type_n_nb.push_back(n_nb);
+    site_type[s] = t;
+  }
+
+  // list every combination of anti-aligned neighbor counts for each type
+  type_outcomes.resize(type_n_nb.size());
+  for (int t = 0; t < type_n_nb.size(); t++) {
+    type_outcomes[t].clear();
+    Outcome o = {};
+    while (true) {
+      type_outcomes[t].push_back(o);
+
+      // next combination
+      int c = 0;
+      while (c < n_classes && o.n_anti[c] == type_n_nb[t][c]) {
+        o.n_anti[c] = 0;
+        c++;
+      }
+      if (c == n_classes) break;
+      o.n_anti[c]++;
+    }
+  }
+
+  // total link weight around each type of site
+  type_wt_sum.assign(type_n_nb.size(), 0.0);
+  for (int t = 0; t < type_n_nb.size(); t++) {
+    for (int c = 0; c < n_classes; c++) {
+      type_wt_sum[t] += class_wt[c] * type_n_nb[t][c];
+    }
+  }
+
+  outcome_beta = NAN;
+  return true;
+}
+
+/// @brief Calculate the Ising model action of one replica
+/// @param r Replica index
+/// @return The action per spin
+double QfeIsingMultiSpin::Action(int r) {
+  lattice->SyncAdjacency();
+  const int* adj_offset = lattice->adj_offset.data();
+  const int* adj_sites = lattice->adj_sites.data();
+  const double* adj_wt = lattice->adj_wt.data();
+  double action = 0.0;
+
+  // sum over links (each link is visited once from each end)
+  for (int s = 0; s < lattice->n_sites; s++) {
+    double spin_sum = 0.0;
+    for (int i = adj_offset[s]; i < adj_offset[s + 1]; i++) {
+      bool anti = ((spin[s] ^ spin[adj_sites[i]]) >> r) & 1;
+      spin_sum += anti ? -adj_wt[i] : adj_wt[i];
+    }
+    action -= 0.5 * beta * spin_sum;
+  }
+
+  return action / lattice->vol;
+}
+
+/// @brief Compute the mean spin value of one replica, weighted by site weights
+/// @param r Replica index
+/// @return The mean spin (i.e. magnetization)
+double QfeIsingMultiSpin::MeanSpin(int r) {
+  double m = 0.0;
+  for (int s = 0; s < lattice->n_sites; s++) {
+    bool down = (spin[s] >> r) & 1;
+    m += down ? -lattice->sites[s].wt : lattice->sites[s].wt;
+  }
+  return m / lattice->vol;
+}
+
+/// @brief Randomize all spins of all replicas
+void QfeIsingMultiSpin::HotStart() {
+  for (int s = 0; s < lattice->n_sites; s++) spin[s] = gen();
+}
+
+/// @brief Set all spins of all replicas to +1
+void QfeIsingMultiSpin::ColdStart() {
+  std::fill(spin.begin(), spin.end(), 0);
+}
+
+/// @brief Metropolis update of all 64 replicas. For each site, the number of
+/// anti-aligned neighbors in each link class is accumulated for all replicas
+/// in bit-sliced counters. Each replica then accepts the flip if its counts
+/// match an outcome with delta_S <= 0, or if its own random number is below
+/// the flip probability for its outcome. The random numbers are compared one
+/// bit at a time for all replicas, starting from the most significant bit,
+/// so only a few random words are needed per site.
+/// @return The acceptance rate (averaged over all replicas)
+double QfeIsingMultiSpin::Metropolis() {
+  if (!multi_spin) return ReplicaMetropolis();
+  QFE_PROFILE_SCOPE("QfeIsingMultiSpin::Metropolis", "site-updates");
+  QFE_PROFILE_WORK(64.0 * lattice->n_sites);
+  lattice->SyncAdjacency();
+  const int* adj_offset = lattice->adj_offset.data();
+  const int* adj_sites = lattice->adj_sites.data();
+  const int* adj_class = this->adj_class.data();
+
+  // update the flip probabilities if the coupling changed
+  if (!(outcome_beta == beta)) {
+    for (int t = 0; t < type_outcomes.size(); t++) {
+      for (Outcome& o : type_outcomes[t]) {
+        double anti_sum = 0.0;
+        for (int c = 0; c < n_classes; c++) {
+          anti_sum += class_wt[c] * o.n_anti[c];
+        }
+        double delta_S = 2.0 * beta * (type_wt_sum[t] - 2.0 * anti_sum);
+        o.always_flip = (delta_S <= 0.0);
+        double p_flip = fmin(exp(-delta_S) * 4294967296.0, 4294967295.0);
+        o.threshold = o.always_flip ? 0 : uint32_t(p_flip);  // 2^32 * p
+      }
+    }
+    outcome_beta = beta;
+  }
+
+  long accept = 0;
+  for (int s = 0; s < lattice->n_sites; s++) {
+    uint64_t spin_s = spin[s];
+
+    // bit-sliced counters of anti-aligned neighbors in each class
+    uint64_t count[MAX_MSC_CLASSES][5] = {};
+    for (int i = adj_offset[s]; i < adj_offset[s + 1]; i++) {
+      uint64_t* cnt = count[adj_class[i]];
+      uint64_t carry = spin_s ^ spin[adj_sites[i]];
+      for (int b = 0; b < 5 && carry; b++) {
+        uint64_t next = cnt[b] & carry;
+        cnt[b] ^= carry;
+        carry = next;
+      }
+    }
+
+    // find which replicas have each outcome
+    uint64_t flip = 0;  // replicas that will flip
+    uint64_t undecided = 0;  // replicas that need a random number
+    uint64_t threshold_bits[32] = {};  // bit-sliced flip thresholds
+    for (const Outcome& o : type_outcomes[site_type[s]]) {
+      uint64_t mask = ~uint64_t(0);
+      for (int c = 0; c < n_classes; c++) {
+        for (int b = 0; b < 5; b++) {
+          mask &= ((o.n_anti[c] >> b) & 1) ? count[c][b] : ~count[c][b];
+        }
+      }
+      if (!mask) continue;
+      if (o.always_flip) {
+        flip |= mask;
+      } else {
+        undecided |= mask;
+        for (int j = 0; j < 32; j++) {
+          if ((o.threshold >> (31 - j)) & 1) threshold_bits[j] |= mask;
+        }
+      }
+    }
+
+    // compare a uniform random number with the threshold for each replica,
+    // most significant bit first, until every replica is decided
+    for (int j = 0; j < 32 && undecided; j++) {
+      uint64_t u = gen();
+      flip |= undecided & threshold_bits[j] & ~u;
+      undecided &= ~(threshold_bits[j] ^ u);
+    }
+
+    spin[s] = spin_s ^ flip;
+    accept += __builtin_popcountll(flip);
+  }
+
+  return double(accept) / (64.0 * double(lattice->n_sites));
+}
+
+/// @brief Metropolis update of each replica in turn, using the link weights
+/// directly. This is the fallback for lattices with too many distinct link
+/// weights for the bit-sliced counters.
+/// @return The acceptance rate (averaged over all replicas)
+double QfeIsingMultiSpin::ReplicaMetropolis() {
+  QFE_PROFILE_SCOPE("QfeIsingMultiSpin::ReplicaMetropolis", "site-updates");
+  QFE_PROFILE_WORK(64.0 * lattice->n_sites);
+  lattice->SyncAdjacency();
+  const int* adj_offset = lattice->adj_offset.data();
+  const int* adj_sites = lattice->adj_sites.data();
+  const double* adj_wt = lattice->adj_wt.data();
+
+  long accept = 0;
+  for (int s = 0; s < lattice->n_sites; s++) {
+    uint64_t spin_s = spin[s];
+    uint64_t flip = 0;
+    for (int r = 0; r < 64; r++) {
+      // sum of the link weights to aligned neighbors minus anti-aligned ones
+      double wt_sum = 0.0;
+      for (int i = adj_offset[s]; i < adj_offset[s + 1]; i++) {
+        bool anti = ((spin_s ^ spin[adj_sites[i]]) >> r) & 1;
+        wt_sum += anti ? -adj_wt[i] : adj_wt[i];
+      }
+      double delta_S = 2.0 * beta * wt_sum;
+
+      double u = double(gen() >> 11) / 9007199254740992.0;  // 2^53
+      if (delta_S <= 0.0 || u < exp(-delta_S)) flip |= uint64_t(1) << r;
+    }
+
+    spin[s] = spin_s ^ flip;
+    accept += __builtin_popcountll(flip);
+  }
+
+  return double(accept) / (64.0 * double(lattice->n_sites));
+}
+
+/// @brief Copy one replica into an ordinary Ising field
+/// @param r Replica index
+/// @param field Ising field on the same lattice
+void QfeIsingMultiSpin::GetReplica(int r, QfeIsing& field) {
+  for (int s = 0; s < lattice->n_sites; s++) {
+    field.spin[s] = ((spin[s] >> r) & 1) ? -1.0 : 1.0;
+  }
+}
+
+/// @brief Set one replica from an ordinary Ising field
+/// @param r Replica index
+/// @param field Ising field on the same lattice
+void QfeIsingMultiSpin::SetReplica(int r, QfeIsing& field) {
+  uint64_t bit = uint64_t(1) << r;
+  for (int s = 0; s < lattice->n_sites; s++) {
+    if (field.spin[s] < 0.0) {
+      spin[s] |= bit;
+    } else {
+      spin[s] &= ~bit;
+    }
+  }
+}
@@ -2,15 +2,26 @@
 
 #pragma once
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <numeric>
+#include <queue>
 #include <random>
 #include <stack>
 #include <string>
+#include <thread>
+#include <tuple>
 #include <unordered_map>
 #include <vector>
 
+#include "parallel.h"
 #include "rng.h"
 
 #define MAX_SITE_NEIGHBORS 20
@@ -20,6 +31,13 @@
 #define MAX_CELL_FACES 4
 #define MAX_CELL_SITES 4
 
+// number of consecutive sites that share a random number stream in
+// parallel sweeps (changing this changes the generated Markov chains)
+#define QFE_SWEEP_BLOCK_SIZE 256
+
+// binary lattice file format version (increment when the layout changes)
+#define QFE_LATTICE_BINARY_VERSION 1
+
 struct QfeSite {
   double wt;                          // site weight
   int nn;                             // number of nearest neighbors
@@ -52,7 +70,106 @@ struct QfeCell {
   int sites[MAX_CELL_SITES];
 };
 
-class QfeLattice {
+struct QfeLatticeHeader {
+  char magic[8];             // "QFELATB" identifies a binary lattice file
+  int32_t version;           // file format version
+  int32_t n_sites;           // number of sites
+  int32_t n_links;           // number of links
+  int32_t n_faces;           // number of faces
+  int32_t n_cells;           // number of cells
+  int32_t reserved;          // padding (always zero)
+  double vol;                // lattice volume
+  uint64_t payload_size;     // number of bytes following the header
+  uint64_t payload_checksum; // FNV-1a hash of the payload
+};
+
+/**
+ * @brief Compute the 64-bit FNV-1a hash of @p n bytes of @p data.
+ */
+
+uint64_t Fnv1aHash(const char* data, size_t n) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < n; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/**
+ * @brief Append an array of @p count elements to a binary buffer. The array
+ * is preceded by its element count and element size so that it can be
+ * validated when it is read back.
+ */
+
+template <typename T>
+void BinaryAppend(std::vector<char>& buf, const T* data, size_t count) {
+  uint64_t array_info[2] = {count, sizeof(T)};
+  const char* info_bytes = (const char*)array_info;
+  const char* data_bytes = (const char*)data;
+  buf.insert(buf.end(), info_bytes, info_bytes + sizeof(array_info));
+  buf.insert(buf.end(), data_bytes, data_bytes + count * sizeof(T));
+}
+
+template <typename T>
+void BinaryAppend(std::vector<char>& buf, const std::vector<T>& v) {
+  BinaryAppend(buf, v.data(), v.size());
+}
+
+/**
+ * @brief Extract an array of exactly @p count elements written by
+ * BinaryAppend. @p data is advanced past the array. Returns false if the
+ * array does not match or runs past @p end.
+ */
+
+template <typename T>
+bool BinaryExtract(const char*& data, const char* end, T* out, size_t count) {
+  uint64_t array_info[2];
+  if (end - data < (ptrdiff_t)sizeof(array_info)) return false;
+  memcpy(array_info, data, sizeof(array_info));
+  if (array_info[0] != count || array_info[1] != sizeof(T)) return false;
+  data += sizeof(array_info);
+
+  size_t n_bytes = count * sizeof(T);
+  if (end - data < (ptrdiff_t)n_bytes) return false;
+  memcpy((void*)out, data, n_bytes);
+  data += n_bytes;
+  return true;
+}
+
+template <typename T>
+bool BinaryExtract(const char*& data, const char* end, std::vector<T>& v) {
+  uint64_t array_info[2];
+  if (end - data < (ptrdiff_t)sizeof(array_info)) return false;
+  memcpy(array_info, data, sizeof(array_info));
+  v.resize(array_info[0]);
+  return BinaryExtract(data, end, v.data(), v.size());
+}
+
+/**
+ * @brief Apply a site permutation to a per-site array, so that the element
+ * at old index i moves to index @p new_index[i]. Arrays that have not been
+ * filled for every site (e.g. optional tables) are left unchanged.
+ */
+
+template <typename T>
+void PermuteArray(std::vector<T>& v, const std::vector<int>& new_index) {
+  if (v.size() != new_index.size()) return;
+  std::vector<T> v_old = v;
+  for (int i = 0; i < new_index.size(); i++) {
+    v[new_index[i]] = v_old[i];
+  }
+}
+
+/**
+ * @brief Lattice of sites, links, faces, and cells with weights. The update
+ * kernels read the links through the CSR adjacency arrays (see
+ * UpdateAdjacency), which hold a copy of the link weights. Any code that
+ * writes links[l].wt directly must then set adj_valid to false (or call
+ * UpdateAdjacency), otherwise the kernels will use the old weights.
+ */
+
+class QfeLattice : public QfeChainRng {
  public:
   QfeLattice();
   virtual void WriteLattice(FILE* file);
@@ -65,7 +182,10 @@ class QfeLattice {
   virtual void ReadLink(FILE* file, int l);
   virtual void ReadFace(FILE* file, int f);
   virtual void ReadCell(FILE* file, int c);
-  void SeedRng(unsigned int seed);
+  void WriteLatticeBinary(FILE* file);
+  bool ReadLatticeBinary(const char* path);
+  virtual void WriteBinaryData(std::vector<char>& buf);
+  virtual bool ReadBinaryData(const char*& data, const char* end);
   void InitRect(int Nx, int Ny, double wt_x, double wt_y);
   void InitTriangle(int N, double wt1, double wt2, double wt3);
   void InitTriangle(int Nx, int Ny, double wt1, double wt2, double wt3);
@@ -80,6 +200,15 @@ class QfeLattice {
   int AddFace(int a, int b, int c, int d, double wt = 1.0);
   int AddCell(int a, int b, int c, int d, double wt = 1.0);
   void UpdateDistinct();
+  std::vector<int> Reorder();
+  virtual void PermuteSites(const std::vector<int>& new_index);
+  void UpdateAdjacency();
+  void SyncAdjacency();
+  void UpdateColoring();
+  void SyncColoring();
+  template <typename Kernel>
+  int ColorSweep(Kernel kernel, int n_threads = 0,
+                 QfeChainRng* chain_rng = nullptr);
   void Refine2D(int n_refine);
   void PrintSites();
   void PrintLinks();
@@ -104,7 +233,23 @@ class QfeLattice {
   std::vector<int> distinct_first;    // representative site for distinct group
   int n_distinct;
 
-  QfeRng rng;
+  // compressed sparse row (CSR) adjacency for the update kernels
+  std::vector<int> adj_offset;  // first adjacency entry for each site
+  std::vector<int> adj_sites;   // neighbor site for each adjacency entry
+  std::vector<int> adj_links;   // link for each adjacency entry
+  std::vector<double> adj_wt;   // link weight for each adjacency entry
+  bool adj_valid;               // false if the adjacency needs to be rebuilt
+  int adj_version;              // incremented each time it is rebuilt
+
+  // site coloring for parallel sweeps (neighboring sites never share a color)
+  std::vector<int> site_color;    // color of each site
+  std::vector<int> color_offset;  // first color_sites entry for each color
+  std::vector<int> color_sites;   // sites ordered by color, then by index
+  int n_colors;
+  bool color_valid;  // false if the coloring needs to be rebuilt
+
+  // the random number generators (rng, block_rng, counter_rng, and
+  // use_counter_rng) are inherited from QfeChainRng
 };
 
 QfeLattice::QfeLattice() {
@@ -114,6 +259,10 @@ QfeLattice::QfeLattice() {
   n_cells = 0;
   vol = 0.0;
   n_distinct = 0;
+  adj_valid = false;
+  adj_version = 0;
+  n_colors = 0;
+  color_valid = false;
 }
 
 void QfeLattice::WriteLattice(FILE* file) {
@@ -308,12 +457,126 @@ void QfeLattice::ReadCell(FILE* file, int c) {
 }
 
 /**
- * @brief Reset and seed the random number generator
- *
- * @param seed Random number generator seed value
+ * @brief Write the lattice to a binary file that can be loaded quickly with
+ * ReadLatticeBinary. The file consists of a QfeLatticeHeader followed by flat
+ * arrays of sites, links, faces, and cells, plus any extra arrays written by
+ * subclasses in WriteBinaryData.
+ */
+
+void QfeLattice::WriteLatticeBinary(FILE* file) {
+  std::vector<char> payload;
+  WriteBinaryData(payload);
+
+  QfeLatticeHeader header;
+  memset(&header, 0, sizeof(header));
+  strcpy(header.magic, "QFELATB");
+  header.version = QFE_LATTICE_BINARY_VERSION;
+  header.n_sites = n_sites;
+  header.n_links = n_links;
+  header.n_faces = n_faces;
+  header.n_cells = n_cells;
+  header.vol = vol;
+  header.payload_size = payload.size();
+  header.payload_checksum = Fnv1aHash(payload.data(), payload.size());
+
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(payload.data(), 1, payload.size(), file);
+}
+
+/**
+ * @brief Read a binary lattice file written by WriteLatticeBinary. The file is
+ * memory mapped so that the checksum can be verified in place, and its arrays
+ * are then copied once into the lattice's own vectors, so no links, faces, or
+ * cells need to be searched for or recreated. Returns false (leaving the
+ * lattice in an undefined state) if the file is invalid.
+ */
+
+bool QfeLattice::ReadLatticeBinary(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, "unable to open lattice file: %s\n", path);
+    return false;
+  }
+
+  struct stat file_stat;
+  fstat(fd, &file_stat);
+  size_t file_size = file_stat.st_size;
+  if (file_size < sizeof(QfeLatticeHeader)) {
+    fprintf(stderr, "invalid lattice file: %s\n", path);
+    close(fd);
+    return false;
+  }
+
+  void* map = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "unable to map lattice file: %s\n", path);
+    return false;
+  }
+
+  const char* data = (const char*)map;
+  const char* end = data + file_size;
+  QfeLatticeHeader header;
+  memcpy(&header, data, sizeof(header));
+  data += sizeof(header);
+
+  bool success = true;
+  if (strncmp(header.magic, "QFELATB", 8)) {
+    fprintf(stderr, "invalid lattice file: %s\n", path);
+    success = false;
+  } else if (header.version != QFE_LATTICE_BINARY_VERSION) {
+    fprintf(stderr, "unsupported lattice file version %d (expected %d)\n",
+            header.version, QFE_LATTICE_BINARY_VERSION);
+    success = false;
+  } else if (header.payload_size != uint64_t(end - data) ||
+             header.payload_checksum != Fnv1aHash(data, end - data)) {
+    fprintf(stderr, "corrupted lattice file: %s\n", path);
+    success = false;
+  } else if (!ReadBinaryData(data, end) || data != end ||
+             n_sites != header.n_sites || n_links != header.n_links ||
+             n_faces != header.n_faces || n_cells != header.n_cells) {
+    fprintf(stderr, "inconsistent lattice file: %s\n", path);
+    success = false;
+  }
+
+  munmap(map, file_size);
+  if (!success) return false;
+
+  vol = header.vol;
+  UpdateDistinct();
+  return true;
+}
+
+/**
+ * @brief Append the lattice arrays to a binary buffer. Subclasses should
+ * override this to append their own arrays after calling the base version.
  */
 
-void QfeLattice::SeedRng(unsigned int seed) { rng = QfeRng(seed); }
+void QfeLattice::WriteBinaryData(std::vector<char>& buf) {
+  BinaryAppend(buf, sites.data(), n_sites);
+  BinaryAppend(buf, links);
+  BinaryAppend(buf, faces);
+  BinaryAppend(buf, cells);
+}
+
+/**
+ * @brief Read the arrays written by WriteBinaryData, advancing @p data.
+ * Returns false if the data is inconsistent.
+ */
+
+bool QfeLattice::ReadBinaryData(const char*& data, const char* end) {
+  if (!BinaryExtract(data, end, sites)) return false;
+  ResizeSites(sites.size());  // resize any subclass site arrays
+
+  if (!BinaryExtract(data, end, links)) return false;
+  if (!BinaryExtract(data, end, faces)) return false;
+  if (!BinaryExtract(data, end, cells)) return false;
+  n_links = links.size();
+  n_faces = faces.size();
+  n_cells = cells.size();
+  adj_valid = false;
+  return true;
+}
 
 /**
  * @brief Create a flat, rectangular lattice with periodic boundary conditions
@@ -352,6 +615,9 @@ void QfeLattice::InitRect(int Nx, int Ny, double wt1, double wt2) {
     links[faces[f].edges[2]].wt = wt1;
     links[faces[f].edges[3]].wt = wt2;
   }
+
+  // link weights have changed
+  adj_valid = false;
 }
 
 /**
@@ -412,6 +678,9 @@ void QfeLattice::InitTriangle(int Nx, int Ny, double wt1, double wt2,
     links[l2].wt = wt2;
     links[l3].wt = wt3;
   }
+
+  // link weights have changed
+  adj_valid = false;
 }
 
 /**
@@ -421,6 +690,7 @@ void QfeLattice::InitTriangle(int Nx, int Ny, double wt1, double wt2,
 void QfeLattice::ResizeSites(int n_sites) {
   this->n_sites = n_sites;
   sites.resize(n_sites);
+  adj_valid = false;
 }
 
 /**
@@ -555,9 +825,165 @@ int QfeLattice::AddLink(int a, int b, double wt) {
 
   links.push_back(link);
   n_links = links.size();
+  adj_valid = false;
   return l;
 }
 
+/**
+ * @brief Renumber the sites to improve memory locality using the reverse
+ * Cuthill-McKee algorithm, which keeps the indices of neighboring sites close
+ * together. Links are then renumbered in order of their lowest site index.
+ * Faces and cells keep their indices. Returns the permutation, where site s
+ * has been moved to index new_index[s]. A field saved before reordering can be
+ * remapped via phi_new[new_index[s]] = phi_old[s].
+ */
+
+std::vector<int> QfeLattice::Reorder() {
+  std::vector<int> order;  // old site index for each new site index
+  order.reserve(n_sites);
+  std::vector<bool> is_ordered(n_sites, false);
+
+  // sites sorted by degree to find starting sites for each component
+  std::vector<int> by_degree(n_sites);
+  std::iota(by_degree.begin(), by_degree.end(), 0);
+  std::stable_sort(by_degree.begin(), by_degree.end(),
+                   [&](int a, int b) { return sites[a].nn < sites[b].nn; });
+
+  std::vector<int> level(n_sites, -1);
+  for (int i = 0; i < n_sites; i++) {
+    int s_start = by_degree[i];
+    if (is_ordered[s_start]) continue;
+
+    // find a pseudo-peripheral starting site by repeatedly moving to the
+    // lowest degree site in the last level of a breadth-first search until
+    // the eccentricity stops increasing
+    int eccentricity = -1;
+    while (true) {
+      std::vector<int> component;
+      std::queue<int> queue;
+      queue.push(s_start);
+      level[s_start] = 0;
+      component.push_back(s_start);
+      int max_level = 0;
+      int s_far = s_start;
+      while (!queue.empty()) {
+        int s = queue.front();
+        queue.pop();
+        for (int n = 0; n < sites[s].nn; n++) {
+          int s_n = sites[s].neighbors[n];
+          if (s_n >= n_sites || level[s_n] != -1) continue;
+          level[s_n] = level[s] + 1;
+          component.push_back(s_n);
+          queue.push(s_n);
+          if (level[s_n] > max_level ||
+              (level[s_n] == max_level && sites[s_n].nn < sites[s_far].nn)) {
+            max_level = level[s_n];
+            s_far = s_n;
+          }
+        }
+      }
+      for (int s : component) level[s] = -1;
+      if (max_level <= eccentricity) break;
+      eccentricity = max_level;
+      s_start = s_far;
+    }
+
+    // cuthill-mckee ordering: breadth-first search visiting the neighbors of
+    // each site in order of increasing degree
+    int first = order.size();
+    order.push_back(s_start);
+    is_ordered[s_start] = true;
+    for (int j = first; j < order.size(); j++) {
+      int s = order[j];
+      int n_first = order.size();
+      for (int n = 0; n < sites[s].nn; n++) {
+        int s_n = sites[s].neighbors[n];
+        if (s_n >= n_sites || is_ordered[s_n]) continue;
+        is_ordered[s_n] = true;
+        order.push_back(s_n);
+      }
+      std::stable_sort(
+          order.begin() + n_first, order.end(),
+          [&](int a, int b) { return sites[a].nn < sites[b].nn; });
+    }
+  }
+
+  // reverse the ordering and invert the permutation
+  std::reverse(order.begin(), order.end());
+  std::vector<int> new_index(n_sites);
+  for (int s = 0; s < n_sites; s++) {
+    new_index[order[s]] = s;
+  }
+
+  PermuteSites(new_index);
+
+  // renumber the links in order of their lowest site index
+  std::vector<int> link_order(n_links);
+  std::iota(link_order.begin(), link_order.end(), 0);
+  std::vector<int> link_key(n_links);
+  for (int l = 0; l < n_links; l++) {
+    link_key[l] = std::min(links[l].sites[0], links[l].sites[1]);
+  }
+  std::stable_sort(link_order.begin(), link_order.end(),
+                   [&](int a, int b) { return link_key[a] < link_key[b]; });
+  std::vector<int> new_link(n_links);
+  for (int l = 0; l < n_links; l++) {
+    new_link[link_order[l]] = l;
+  }
+  PermuteArray(links, new_link);
+  for (int s = 0; s < n_sites; s++) {
+    for (int n = 0; n < sites[s].nn; n++) {
+      sites[s].links[n] = new_link[sites[s].links[n]];
+    }
+  }
+  for (int f = 0; f < n_faces; f++) {
+    for (int e = 0; e < faces[f].n_edges; e++) {
+      faces[f].edges[e] = new_link[faces[f].edges[e]];
+    }
+  }
+
+  UpdateDistinct();
+  adj_valid = false;
+  return new_index;
+}
+
+/**
+ * @brief Move each site s to index @p new_index[s] and update all references
+ * to sites in the site, link, face, and cell tables. Subclasses should override
+ * this to permute their own per-site arrays after calling the base version.
+ */
+
+void QfeLattice::PermuteSites(const std::vector<int>& new_index) {
+  PermuteArray(sites, new_index);
+  for (int s = 0; s < n_sites; s++) {
+    for (int n = 0; n < sites[s].nn; n++) {
+      int s_n = sites[s].neighbors[n];
+      if (s_n < n_sites) sites[s].neighbors[n] = new_index[s_n];
+    }
+  }
+
+  for (int l = 0; l < n_links; l++) {
+    for (int i = 0; i < 2; i++) {
+      int s = links[l].sites[i];
+      if (s < n_sites) links[l].sites[i] = new_index[s];
+    }
+  }
+
+  for (int f = 0; f < n_faces; f++) {
+    for (int i = 0; i < faces[f].n_edges; i++) {
+      faces[f].sites[i] = new_index[faces[f].sites[i]];
+    }
+  }
+
+  for (int c = 0; c < n_cells; c++) {
+    for (int i = 0; i < MAX_CELL_SITES; i++) {
+      cells[c].sites[i] = new_index[cells[c].sites[i]];
+    }
+  }
+
+  adj_valid = false;
+}
+
 /**
  * @brief Update the number of sites in each distinct group and find the
  * first site from each distinct group.
@@ -585,6 +1011,201 @@ void QfeLattice::UpdateDistinct() {
   }
 }
 
+/**
+ * @brief Rebuild the compressed sparse row adjacency arrays from the site
+ * neighbor tables. The neighbors of site s are adj_sites[i] for
+ * adj_offset[s] <= i < adj_offset[s + 1], connected by link adj_links[i] with
+ * weight adj_wt[i]. Adding links or resizing the lattice marks the adjacency
+ * as out of date, and the update kernels rebuild it on demand. Link weights are
+ * copied, so this must be called (or adj_valid set to false) after modifying
+ * link weights directly.
+ */
+
+void QfeLattice::UpdateAdjacency() {
+  adj_offset.resize(n_sites + 1);
+  adj_offset[0] = 0;
+  for (int s = 0; s < n_sites; s++) {
+    adj_offset[s + 1] = adj_offset[s] + sites[s].nn;
+  }
+
+  int n_adj = adj_offset[n_sites];
+  adj_sites.resize(n_adj);
+  adj_links.resize(n_adj);
+  adj_wt.resize(n_adj);
+
+  for (int s = 0; s < n_sites; s++) {
+    int i = adj_offset[s];
+    for (int n = 0; n < sites[s].nn; n++, i++) {
+      int l = sites[s].links[n];
+      adj_sites[i] = sites[s].neighbors[n];
+      adj_links[i] = l;
+      adj_wt[i] = links[l].wt;
+    }
+  }
+
+  adj_valid = true;
+  adj_version++;
+  color_valid = false;
+}
+
+/**
+ * @brief Rebuild the adjacency arrays only if they are out of date.
+ */
+
+void QfeLattice::SyncAdjacency() {
+  if (!adj_valid) UpdateAdjacency();
+}
+
+/**
+ * @brief Color the sites so that no two neighboring sites share a color,
+ * using the DSATUR heuristic: the next site to be colored is always the one
+ * whose neighbors already use the most distinct colors (ties broken by degree,
+ * then by site index), and it gets the lowest color not used by its
+ * neighbors. Sites of one color can then be updated in parallel. Triangulated
+ * spheres typically need 4 colors, flat triangular lattices 3, and
+ * q-regular AdS lattices more. Rebuilding the adjacency marks the coloring as
+ * out of date.
+ */
+
+void QfeLattice::UpdateColoring() {
+  SyncAdjacency();
+
+  // bit mask of the colors used by the neighbors of each site (the number of
+  // colors can never exceed MAX_SITE_NEIGHBORS + 1)
+  std::vector<uint32_t> nb_colors(n_sites, 0);
+  site_color.assign(n_sites, -1);
+  n_colors = 0;
+
+  // priority queue of (saturation, degree, -site). entries are pushed every
+  // time a saturation increases, and stale entries are skipped when popped.
+  std::priority_queue<std::tuple<int, int, int>> queue;
+  for (int s = 0; s < n_sites; s++) {
+    queue.push(std::make_tuple(0, adj_offset[s + 1] - adj_offset[s], -s));
+  }
+
+  while (!queue.empty()) {
+    int sat = std::get<0>(queue.top());
+    int s = -std::get<2>(queue.top());
+    queue.pop();
+    if (site_color[s] != -1) continue;
+    if (sat != __builtin_popcount(nb_colors[s])) continue;
+
+    // lowest color not used by a neighbor
+    int c = 0;
+    while (nb_colors[s] & (1u << c)) c++;
+    site_color[s] = c;
+    n_colors = std::max(n_colors, c + 1);
+
+    for (int i = adj_offset[s]; i < adj_offset[s + 1]; i++) {
+      int s_n = adj_sites[i];
+      if (s_n >= n_sites || site_color[s_n] != -1) continue;
+      if (nb_colors[s_n] & (1u << c)) continue;
+      nb_colors[s_n] |= (1u << c);
+      int deg = adj_offset[s_n + 1] - adj_offset[s_n];
+      queue.push(
+          std::make_tuple(__builtin_popcount(nb_colors[s_n]), deg, -s_n));
+    }
+  }
+
+  // list the sites of each color in order of increasing site index
+  color_offset.assign(n_colors + 1, 0);
+  for (int s = 0; s < n_sites; s++) color_offset[site_color[s] + 1]++;
+  for (int c = 0; c < n_colors; c++) color_offset[c + 1] += color_offset[c];
+  color_sites.resize(n_sites);
+  std::vector<int> i_next(color_offset.begin(), color_offset.end() - 1);
+  for (int s = 0; s < n_sites; s++) {
+    color_sites[i_next[site_color[s]]++] = s;
+  }
+
+  color_valid = true;
+}
+
+/**
+ * @brief Rebuild the site coloring only if it is out of date.
+ */
+
+void QfeLattice::SyncColoring() {
+  SyncAdjacency();
+  if (!color_valid) UpdateColoring();
+}
+
+/**
+ * @brief Apply @p kernel to every site, one color at a time, spreading the
+ * sites of each color over @p n_threads threads of the global thread pool
+ * (0 for one per core). The kernel is called as kernel(s, b, rng) where
+ * b = s / QFE_SWEEP_BLOCK_SIZE is the block containing site s and rng is the
+ * random number stream for that block. A block is always handled by a single
+ * thread and its sites are visited in a fixed order, so the result is bitwise
+ * reproducible for a given seed regardless of the number of threads. The block
+ * streams are seeded from the lattice rng on first use (and again after
+ * SeedRng). If use_counter_rng is set, rng is instead the stream of counter_rng
+ * for the current sweep and site s, so the result also does not depend on the
+ * block size or on the order in which the sites of a color are visited, and
+ * counter_rng.sweep is advanced after each call. The kernel should therefore
+ * accept any rng type (e.g. a lambda with an auto& parameter). The kernel must
+ * only write to site s (or to per-block data) and may read its neighbors.
+ * Returns the sum of the values returned by the kernel. The generators are
+ * taken from @p chain_rng, or from the lattice itself if it is null. If the
+ * coloring is already up to date, the lattice is not modified, so independent
+ * chains with their own generators can sweep the same lattice concurrently.
+ */
+
+template <typename Kernel>
+int QfeLattice::ColorSweep(Kernel kernel, int n_threads,
+                           QfeChainRng* chain_rng) {
+  SyncColoring();
+  if (chain_rng == nullptr) chain_rng = this;
+  std::vector<QfeRng>& blocks = chain_rng->block_rng;
+  QfeCounterRng& crng = chain_rng->counter_rng;
+  bool use_crng = chain_rng->use_counter_rng;
+
+  int n_blocks = (n_sites + QFE_SWEEP_BLOCK_SIZE - 1) / QFE_SWEEP_BLOCK_SIZE;
+  if (blocks.size() != n_blocks) {
+    blocks.resize(n_blocks);
+    for (int b = 0; b < n_blocks; b++) {
+      blocks[b] = QfeRng(chain_rng->rng.gen());
+    }
+  }
+
+  n_threads = std::max(1, std::min(NumThreads(n_threads), n_blocks));
+  std::vector<int> thread_sum(n_threads, 0);
+
+  for (int c = 0; c < n_colors; c++) {
+    const int* c_begin = color_sites.data() + color_offset[c];
+    const int* c_end = color_sites.data() + color_offset[c + 1];
+
+    // each thread handles every n_threads-th block of this color
+    auto sweep_blocks = [&](int t) {
+      int sum = 0;
+      for (int b = t; b < n_blocks; b += n_threads) {
+        const int* it = std::lower_bound(c_begin, c_end,
+                                         b * QFE_SWEEP_BLOCK_SIZE);
+        const int* it_end = std::lower_bound(
+            it, c_end, (b + 1) * QFE_SWEEP_BLOCK_SIZE);
+        if (use_crng) {
+          for (; it != it_end; it++) {
+            QfeRngStream site_rng(crng, crng.sweep, *it);
+            sum += kernel(*it, b, site_rng);
+          }
+        } else {
+          for (; it != it_end; it++) {
+            sum += kernel(*it, b, blocks[b]);
+          }
+        }
+      }
+      thread_sum[t] += sum;
+    };
+
+    QfeThreadPool::Global().Run(n_threads, sweep_blocks);
+  }
+
+  if (use_crng) crng.sweep++;
+
+  int sum = 0;
+  for (int t = 0; t < n_threads; t++) sum += thread_sum[t];
+  return sum;
+}
+
 /**
  * @brief Add a triangular face with corner sites @p a, @p b, and @p c.
  * Returns the face index.
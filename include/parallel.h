@@ -0,0 +1,216 @@
+// parallel.h
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// @brief Resolve a requested number of threads
+/// @param n_threads Requested number of threads (0 for one per core)
+/// @return Number of threads to use (at least 1)
+int NumThreads(int n_threads) {
+  if (n_threads <= 0) n_threads = std::thread::hardware_concurrency();
+  return std::max(1, n_threads);
+}
+
+/// @brief Persistent pool of worker threads. Run(n_tasks, task) calls task(t)
+/// once for each t in [0, n_tasks) and returns when all of them are done. The
+/// calling thread takes part, and the workers are created on first use and
+/// then sleep between calls, so the update kernels can use the pool several
+/// times per sweep without paying for thread creation. A call from inside a
+/// task, or while another thread is using the pool, runs the tasks one after
+/// another on the calling thread instead.
+class QfeThreadPool {
+ public:
+  QfeThreadPool();
+  ~QfeThreadPool();
+  QfeThreadPool(const QfeThreadPool&) = delete;
+  QfeThreadPool& operator=(const QfeThreadPool&) = delete;
+  static QfeThreadPool& Global();
+  void Run(int n_tasks, const std::function<void(int)>& task);
+
+ private:
+  static bool& InWorker();
+  void Worker();
+  void RunTasks();
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;                   // guards everything below
+  std::condition_variable start_cv;   // signals the workers to start
+  std::condition_variable done_cv;    // signals the caller that work is done
+  const std::function<void(int)>* task;
+  int n_tasks;
+  std::atomic<int> next_task;  // next task to claim
+  std::atomic<int> n_done;     // number of finished tasks
+  int n_active;                // workers currently claiming tasks
+  unsigned long generation;    // incremented for each call to Run
+  bool stop;                   // workers should exit
+  std::atomic<bool> busy;      // a call to Run is in progress
+};
+
+QfeThreadPool::QfeThreadPool() {
+  task = nullptr;
+  n_tasks = 0;
+  next_task = 0;
+  n_done = 0;
+  n_active = 0;
+  generation = 0;
+  stop = false;
+  busy = false;
+}
+
+QfeThreadPool::~QfeThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  start_cv.notify_all();
+  for (int w = 0; w < workers.size(); w++) workers[w].join();
+}
+
+/// @brief Pool shared by ParallelFor and QfeLattice::ColorSweep
+QfeThreadPool& QfeThreadPool::Global() {
+  static QfeThreadPool pool;
+  return pool;
+}
+
+/// @brief True on the pool's worker threads
+bool& QfeThreadPool::InWorker() {
+  static thread_local bool in_worker = false;
+  return in_worker;
+}
+
+/// @brief Call @p task(t) for each t in [0, n_tasks) using up to n_tasks
+/// threads (including the calling thread)
+/// @param n_tasks Number of tasks
+/// @param task Function to call for each task
+void QfeThreadPool::Run(int n_tasks, const std::function<void(int)>& task) {
+  if (n_tasks <= 1 || InWorker() || busy.exchange(true)) {
+    for (int t = 0; t < n_tasks; t++) task(t);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    while (workers.size() < n_tasks - 1) {
+      workers.push_back(std::thread(&QfeThreadPool::Worker, this));
+    }
+    this->task = &task;
+    this->n_tasks = n_tasks;
+    next_task = 0;
+    n_done = 0;
+    generation++;
+  }
+  start_cv.notify_all();
+
+  // the calling thread also claims tasks, then waits for the workers
+  InWorker() = true;
+  RunTasks();
+  InWorker() = false;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [&] { return n_done == n_tasks && n_active == 0; });
+    this->task = nullptr;
+  }
+  busy = false;
+}
+
+void QfeThreadPool::Worker() {
+  InWorker() = true;
+  unsigned long seen = 0;
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    start_cv.wait(lock, [&] { return stop || generation != seen; });
+    if (stop) return;
+    seen = generation;
+    if (next_task >= n_tasks) continue;  // woke up too late
+
+    n_active++;
+    lock.unlock();
+    RunTasks();
+    lock.lock();
+    n_active--;
+    done_cv.notify_all();
+  }
+}
+
+// claim and run tasks until there are none left
+
+void QfeThreadPool::RunTasks() {
+  while (true) {
+    int t = next_task.fetch_add(1);
+    if (t >= n_tasks) return;
+    (*task)(t);
+    n_done++;
+  }
+}
+
+/// @brief Split the range [0, n) into contiguous chunks, one per thread, and
+/// call f(i_begin, i_end, t) for each chunk t on the threads of the global
+/// pool. The chunks depend on the number of threads, so f should only do work
+/// whose result does not depend on how the range is split.
+/// @param n Size of the range
+/// @param n_threads Number of threads (0 for one per core)
+/// @param f Function to call for each chunk
+template <typename F>
+void ParallelFor(int n, int n_threads, F f) {
+  n_threads = std::min(NumThreads(n_threads), std::max(n, 1));
+  if (n_threads == 1) {
+    f(0, n, 0);
+    return;
+  }
+
+  QfeThreadPool::Global().Run(n_threads, [&](int t) {
+    int i_begin = int((long(n) * t) / n_threads);
+    int i_end = int((long(n) * (t + 1)) / n_threads);
+    f(i_begin, i_end, t);
+  });
+}
+
+/// @brief Find the root of node @p s in a union-find forest that may be
+/// modified by other threads. Each node on the path is pointed to its
+/// grandparent along the way (path halving).
+/// @param parent Parent of each node (roots are their own parent)
+/// @param s Starting node
+/// @return Root node
+int ConcurrentFindRoot(int* parent, int s) {
+  while (true) {
+    int p = __atomic_load_n(&parent[s], __ATOMIC_RELAXED);
+    if (p == s) return s;
+    int gp = __atomic_load_n(&parent[p], __ATOMIC_RELAXED);
+    if (gp != p) {
+      __atomic_compare_exchange_n(&parent[s], &p, gp, false, __ATOMIC_RELAXED,
+                                  __ATOMIC_RELAXED);
+    }
+    s = gp;
+  }
+}
+
+/// @brief Merge the trees containing nodes @p a and @p b in a union-find forest
+/// that may be modified by other threads. The root with the larger index is
+/// always attached to the one with the smaller index (using compare and swap),
+/// so once all merges are done the root of each tree is its smallest node,
+/// regardless of the order in which the merges happened.
+/// @param parent Parent of each node (roots are their own parent)
+/// @param a First node
+/// @param b Second node
+void ConcurrentUnion(int* parent, int a, int b) {
+  while (true) {
+    a = ConcurrentFindRoot(parent, a);
+    b = ConcurrentFindRoot(parent, b);
+    if (a == b) return;
+    if (a > b) std::swap(a, b);
+
+    // attach b to a if b is still a root
+    int expected = b;
+    if (__atomic_compare_exchange_n(&parent[b], &expected, a, false,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      return;
+    }
+  }
+}
@@ -4,16 +4,21 @@
 
 #include <Eigen/Sparse>
 #include <cassert>
+#include <climits>
 #include <cmath>
 #include <stack>
 #include <unordered_map>
 #include <vector>
 
 #include "lattice.h"
+#include "parallel.h"
+#include "statistics.h"
+#include "timer.h"
 
 class QfePhi4 {
  public:
   QfePhi4(QfeLattice* lattice, double msq, double lambda);
+  void SetRng(QfeChainRng* chain_rng);
   void WriteField(FILE* file);
   void ReadField(FILE* file);
   double Action();
@@ -22,30 +27,61 @@ class QfePhi4 {
   void ColdStart();
   double Metropolis();
   double Overrelax();
+  double ParallelMetropolis(int n_threads = 0);
+  double ParallelOverrelax(int n_threads = 0);
   int WolffUpdate(bool storeCluster = true);
   int SWUpdate();
+  int ParallelSWUpdate(int n_threads = 0);
   int FindSWRoot(int s);
   std::vector<double> MInverse(double m0);
+  void StartTracking(int interval = 1000);
+  void StopTracking();
+  void SyncTracking();
+  void CountTrackedUpdate();
+  double TrackedAction();
+  double TrackedMeanPhi();
+  double TrackedMeanPhi2();
+  double TrackedMeanPhi4();
+  double ClusterSusceptibility();
+  double SWClusterSusceptibility();
+  template <typename Bin>
+  void MeasureClusterCorrelator(Bin bin, std::vector<QfeMeasReal>& corr);
 
   QfeLattice* lattice;
+  QfeChainRng* chain_rng;       // random number generators (lattice by default)
   std::vector<double> phi;      // scalar field
   std::vector<double> msq_ct;   // local mass counter terms
   std::vector<double> moments;  // magnetic moments
   double lambda;                // bare coupling
   double msq;                   // bare mass squared
 
+  // running totals maintained by the updates (if tracking is true)
+  bool tracking;        // maintain the running totals
+  int track_interval;   // updates between exact recalculations
+  int track_count;      // updates since the last exact recalculation
+  double track_mag;     // sum of phi * site weight
+  double track_phi2;    // sum of phi^2 * site weight
+  double track_phi4;    // sum of phi^4 * site weight
+  double track_action;  // total action (not divided by the volume)
+
   double metropolis_z;
   double overrelax_demon;
-  std::vector<bool> is_clustered;  // keeps track of which sites are clustered
+  std::vector<double> block_demon;  // demon for each block in parallel sweeps
+  std::vector<int> cluster_stamp;  // site is clustered if equal to cluster_gen
+  int cluster_gen;                 // current wolff cluster generation
+  std::vector<int> cluster_stack;  // sites waiting to be processed
   std::vector<bool> is_fixed;      // dirichlet boundary sites fixed to zero
   std::vector<int> wolff_cluster;  // array of clustered sites
   std::vector<int> sw_root;        // root for each site
+  std::vector<char> sw_flip;       // flip each cluster (indexed by root)
+  std::vector<double> rand_buf;    // random numbers for one metropolis sweep
   // std::vector<std::vector<int>> sw_clusters;  // array of sites in each sw
   // cluster
 };
 
 QfePhi4::QfePhi4(QfeLattice* lattice, double msq, double lambda) {
   this->lattice = lattice;
+  chain_rng = lattice;
   this->msq = msq;
   this->lambda = lambda;
   metropolis_z = 0.5;
@@ -53,33 +89,59 @@ QfePhi4::QfePhi4(QfeLattice* lattice, double msq, double lambda) {
   phi.resize(lattice->sites.size(), 0.0);
   msq_ct.resize(lattice->sites.size(), 0.0);
   is_fixed.resize(lattice->sites.size(), false);
-  is_clustered.resize(lattice->sites.size());
+  cluster_stamp.resize(lattice->sites.size(), 0);
+  cluster_gen = 0;
+  cluster_stack.resize(lattice->sites.size());
   sw_root.resize(lattice->sites.size());
+  tracking = false;
+  track_interval = 1000;
+  track_count = 0;
+  track_mag = 0.0;
+  track_phi2 = 0.0;
+  track_phi4 = 0.0;
+  track_action = 0.0;
+}
+
+// use a separate set of random number generators instead of the lattice's
+// own. fields with their own generators can be updated concurrently on the same
+// lattice once its adjacency and coloring are up to date.
+
+void QfePhi4::SetRng(QfeChainRng* chain_rng) {
+  this->chain_rng = chain_rng;
 }
 
 void QfePhi4::WriteField(FILE* file) {
+  QFE_PROFILE_SCOPE("QfePhi4::WriteField", "bytes");
+  QFE_PROFILE_WORK(phi.size() * sizeof(double));
   fwrite(phi.data(), sizeof(double), phi.size(), file);
 }
 
 void QfePhi4::ReadField(FILE* file) {
+  QFE_PROFILE_SCOPE("QfePhi4::ReadField", "bytes");
+  QFE_PROFILE_WORK(phi.size() * sizeof(double));
   fread(phi.data(), sizeof(double), phi.size(), file);
+  if (tracking) SyncTracking();
 }
 
 double QfePhi4::Action() {
+  lattice->SyncAdjacency();
+  const int* adj_offset = lattice->adj_offset.data();
+  const int* adj_sites = lattice->adj_sites.data();
+  const double* adj_wt = lattice->adj_wt.data();
   double action = 0.0;
 
-  // kinetic contribution
-  for (int l = 0; l < lattice->n_links; l++) {
-    int a = lattice->links[l].sites[0];
-    int b = lattice->links[l].sites[1];
-    double delta_phi = phi[a] - phi[b];
-    double delta_phi2 = delta_phi * delta_phi;
-    action += 0.5 * delta_phi2 * lattice->links[l].wt;
-  }
-
-  // msq and lambda contributions
   for (int s = 0; s < lattice->n_sites; s++) {
     double phi1 = phi[s];
+
+    // kinetic contribution (each link is visited once from each end)
+    double kinetic_term = 0.0;
+    for (int i = adj_offset[s]; i < adj_offset[s + 1]; i++) {
+      double delta_phi = phi1 - phi[adj_sites[i]];
+      kinetic_term += delta_phi * delta_phi * adj_wt[i];
+    }
+    action += 0.25 * kinetic_term;
+
+    // msq and lambda contributions
     double phi2 = phi1 * phi1;  // phi^2
     double phi4 = phi2 * phi2;  // phi^4
     double mass_term = 0.5 * (msq + msq_ct[s]) * phi2;
@@ -99,19 +161,31 @@ double QfePhi4::MeanPhi() {
 }
 
 void QfePhi4::HotStart() {
-  for (int s = 0; s < lattice->n_sites; s++) {
-    phi[s] = lattice->rng.RandNormal();
-  }
+  chain_rng->rng.FillNormal(phi.data(), lattice->n_sites);
+  if (tracking) SyncTracking();
 }
 
 void QfePhi4::ColdStart() {
   std::fill(phi.begin(), phi.begin() + lattice->n_sites, 0.0);
+  if (tracking) SyncTracking();
 }
 
 // metropolis update algorithm
 // ref: N. Metropolis, et al., J. Chem. Phys. 21, 1087 (1953).
 
 double QfePhi4::Metropolis() {
+  QFE_PROFILE_SCOPE("QfePhi4::Metropolis", "site-updates");
+  QFE_PROFILE_WORK(lattice->n_sites);
+  lattice->SyncAdjacency();
+  const int* adj_offset = lattice->adj_offset.data();
+  const int* adj_sites = lattice->adj_sites.data();
+  const double* adj_wt = lattice->adj_wt.data();
+
+  // draw the random numbers for the whole sweep at once (a proposal and an
+  // accept/reject number for each site)
+  rand_buf.resize(2 * lattice->n_sites);
+  chain_rng->rng.FillReal(rand_buf.data(), 2 * lattice->n_sites);
+
   int n_accept = 0;
   int n_tries = 0;
   for (int s = 0; s < lattice->n_sites; s++) {
@@ -121,7 +195,7 @@ double QfePhi4::Metropolis() {
     double phi_old4 = phi_old2 * phi_old2;
 
     // generate a new field value
-    double phi_new = phi_old + lattice->rng.RandReal(-1.0, 1.0) * metropolis_z;
+    double phi_new = phi_old + (2.0 * rand_buf[2 * s] - 1.0) * metropolis_z;
     double phi_new2 = phi_new * phi_new;
     double phi_new4 = phi_new2 * phi_new2;
 
@@ -132,26 +206,31 @@ double QfePhi4::Metropolis() {
     double delta_S = 0.0;
 
     // kinetic contribution to the action
-    QfeSite* site = &lattice->sites[s];
-    for (int n = 0; n < site->nn; n++) {
-      int l = site->links[n];
-      double link_wt = lattice->links[l].wt;
-      delta_S -= phi[site->neighbors[n]] * delta_phi * link_wt;
-      delta_S += 0.5 * delta_phi2 * link_wt;
+    for (int i = adj_offset[s]; i < adj_offset[s + 1]; i++) {
+      delta_S -= phi[adj_sites[i]] * delta_phi * adj_wt[i];
+      delta_S += 0.5 * delta_phi2 * adj_wt[i];
     }
 
     // msq and lambda contributions to the action
     double mass_term = 0.5 * (msq + msq_ct[s]) * delta_phi2;
     double interaction_term = lambda * delta_phi4;
-    delta_S += (mass_term + interaction_term) * site->wt;
+    delta_S += (mass_term + interaction_term) * lattice->sites[s].wt;
 
     // metropolis algorithm
     n_tries++;
-    if (delta_S <= 0.0 || lattice->rng.RandReal() < exp(-delta_S)) {
+    if (delta_S <= 0.0 || rand_buf[2 * s + 1] < exp(-delta_S)) {
+      if (tracking) {
+        double site_wt = lattice->sites[s].wt;
+        track_action += delta_S;
+        track_mag += delta_phi * site_wt;
+        track_phi2 += delta_phi2 * site_wt;
+        track_phi4 += delta_phi4 * site_wt;
+      }
       phi[s] = phi_new;
       n_accept++;
     }
   }
+  if (tracking) CountTrackedUpdate();
   return double(n_accept) / double(n_tries);
 }
 
@@ -175,92 +254,242 @@ double QfePhi4::Metropolis() {
 // balance.
 
 double QfePhi4::Overrelax() {
+  QFE_PROFILE_SCOPE("QfePhi4::Overrelax", "site-updates");
+  QFE_PROFILE_WORK(lattice->n_sites);
+  lattice->SyncAdjacency();
+  const int* adj_offset = lattice->adj_offset.data();
+  const int* adj_sites = lattice->adj_sites.data();
+  const double* adj_wt = lattice->adj_wt.data();
   int n_accept = 0;
   int n_tries = 0;
   for (int s = 0; s < lattice->n_sites; s++) {
     if (is_fixed[s]) continue;
-    QfeSite* site = &lattice->sites[s];
+    double site_wt = lattice->sites[s].wt;
     double phi_old = phi[s];
 
     double numerator = 0.0;
-    double denominator = (msq + msq_ct[s]) * site->wt;
-    for (int n = 0; n < site->nn; n++) {
-      double link_wt = lattice->links[site->links[n]].wt;
-      numerator += link_wt * phi[site->neighbors[n]];
-      denominator += link_wt;
+    double denominator = (msq + msq_ct[s]) * site_wt;
+    for (int i = adj_offset[s]; i < adj_offset[s + 1]; i++) {
+      numerator += adj_wt[i] * phi[adj_sites[i]];
+      denominator += adj_wt[i];
     }
     double phi_new = 2.0 * numerator / denominator - phi_old;
 
     double phi_old4 = phi_old * phi_old * phi_old * phi_old;
     double phi_new4 = phi_new * phi_new * phi_new * phi_new;
     double new_demon = overrelax_demon;
-    new_demon += site->wt * lambda * (phi_old4 - phi_new4);
+    new_demon += site_wt * lambda * (phi_old4 - phi_new4);
 
     n_tries++;
     if (new_demon >= 0) {
+      if (tracking) {
+        // the quadratic part of the action does not change
+        double phi_new2 = phi_new * phi_new;
+        double phi_old2 = phi_old * phi_old;
+        track_action += site_wt * lambda * (phi_new4 - phi_old4);
+        track_mag += (phi_new - phi_old) * site_wt;
+        track_phi2 += (phi_new2 - phi_old2) * site_wt;
+        track_phi4 += (phi_new4 - phi_old4) * site_wt;
+      }
       phi[s] = phi_new;
       overrelax_demon = new_demon;
       n_accept++;
     }
   }
+  if (tracking) CountTrackedUpdate();
   return double(n_accept) / double(n_tries);
 }
 
-// wolff cluster update algorithm
+// parallel versions of the metropolis and overrelaxation updates. sites are
+// updated one color at a time (see QfeLattice::ColorSweep), so the result
+// does not depend on the number of threads, but differs from the sequential
+// sweeps. the overrelaxation demon is split evenly between the site blocks at
+// the start of each sweep so that each block can exchange energy with its own
+// demon, and the block demons are summed back into overrelax_demon at the end.
+
+double QfePhi4::ParallelMetropolis(int n_threads) {
+  QFE_PROFILE_SCOPE("QfePhi4::ParallelMetropolis", "site-updates");
+  QFE_PROFILE_WORK(lattice->n_sites);
+  lattice->SyncAdjacency();
+  const int* adj_offset = lattice->adj_offset.data();
+  const int* adj_sites = lattice->adj_sites.data();
+  const double* adj_wt = lattice->adj_wt.data();
+
+  int n_tries = 0;
+  for (int s = 0; s < lattice->n_sites; s++) {
+    if (!is_fixed[s]) n_tries++;
+  }
+
+  auto kernel = [&](int s, int b, auto& rng) {
+    if (is_fixed[s]) return 0;
+    double phi_old = phi[s];
+    double phi_old2 = phi_old * phi_old;
+    double phi_old4 = phi_old2 * phi_old2;
+
+    // generate a new field value
+    double phi_new = phi_old + rng.RandReal(-1.0, 1.0) * metropolis_z;
+    double phi_new2 = phi_new * phi_new;
+    double phi_new4 = phi_new2 * phi_new2;
+
+    double delta_phi = phi_new - phi_old;
+    double delta_phi2 = phi_new2 - phi_old2;
+    double delta_phi4 = phi_new4 - phi_old4;
+
+    double delta_S = 0.0;
+
+    // kinetic contribution to the action
+    for (int i = adj_offset[s]; i < adj_offset[s + 1]; i++) {
+      delta_S -= phi[adj_sites[i]] * delta_phi * adj_wt[i];
+      delta_S += 0.5 * delta_phi2 * adj_wt[i];
+    }
+
+    // msq and lambda contributions to the action
+    double mass_term = 0.5 * (msq + msq_ct[s]) * delta_phi2;
+    double interaction_term = lambda * delta_phi4;
+    delta_S += (mass_term + interaction_term) * lattice->sites[s].wt;
+
+    // metropolis algorithm
+    if (delta_S <= 0.0 || rng.RandReal() < exp(-delta_S)) {
+      phi[s] = phi_new;
+      return 1;
+    }
+    return 0;
+  };
+
+  int n_accept = lattice->ColorSweep(kernel, n_threads, chain_rng);
+  if (tracking) SyncTracking();
+  return double(n_accept) / double(n_tries);
+}
+
+double QfePhi4::ParallelOverrelax(int n_threads) {
+  QFE_PROFILE_SCOPE("QfePhi4::ParallelOverrelax", "site-updates");
+  QFE_PROFILE_WORK(lattice->n_sites);
+  lattice->SyncAdjacency();
+  const int* adj_offset = lattice->adj_offset.data();
+  const int* adj_sites = lattice->adj_sites.data();
+  const double* adj_wt = lattice->adj_wt.data();
+
+  int n_tries = 0;
+  for (int s = 0; s < lattice->n_sites; s++) {
+    if (!is_fixed[s]) n_tries++;
+  }
+
+  // split the demon between the blocks
+  int n_blocks =
+      (lattice->n_sites + QFE_SWEEP_BLOCK_SIZE - 1) / QFE_SWEEP_BLOCK_SIZE;
+  block_demon.assign(n_blocks, overrelax_demon / double(n_blocks));
+
+  auto kernel = [&](int s, int b, auto& rng) {
+    if (is_fixed[s]) return 0;
+    double site_wt = lattice->sites[s].wt;
+    double phi_old = phi[s];
+
+    double numerator = 0.0;
+    double denominator = (msq + msq_ct[s]) * site_wt;
+    for (int i = adj_offset[s]; i < adj_offset[s + 1]; i++) {
+      numerator += adj_wt[i] * phi[adj_sites[i]];
+      denominator += adj_wt[i];
+    }
+    double phi_new = 2.0 * numerator / denominator - phi_old;
+
+    double phi_old4 = phi_old * phi_old * phi_old * phi_old;
+    double phi_new4 = phi_new * phi_new * phi_new * phi_new;
+    double new_demon = block_demon[b];
+    new_demon += site_wt * lambda * (phi_old4 - phi_new4);
+
+    if (new_demon >= 0) {
+      phi[s] = phi_new;
+      block_demon[b] = new_demon;
+      return 1;
+    }
+    return 0;
+  };
+
+  int n_accept = lattice->ColorSweep(kernel, n_threads, chain_rng);
+
+  // collect the block demons
+  overrelax_demon = 0.0;
+  for (int b = 0; b < n_blocks; b++) {
+    overrelax_demon += block_demon[b];
+  }
+  if (tracking) SyncTracking();
+  return double(n_accept) / double(n_tries);
+}
+
+// wolff cluster update algorithm. clustered sites are marked with a
+// generation stamp, so the cost is proportional to the size of the cluster
+// and its boundary rather than the size of the lattice.
 // ref: U. Wolff, Phys. Rev. Lett. 62, 361 (1989).
 
 int QfePhi4::WolffUpdate(bool storeCluster) {
-  // remove all sites from the cluster
-  std::fill(is_clustered.begin(), is_clustered.end(), false);
+  QFE_PROFILE_SCOPE("QfePhi4::WolffUpdate", "cluster-sites");
+  lattice->SyncAdjacency();
+  const int* adj_offset = lattice->adj_offset.data();
+  const int* adj_sites = lattice->adj_sites.data();
+  const double* adj_wt = lattice->adj_wt.data();
+
+  // start a new cluster generation (all sites become unclustered)
+  if (cluster_gen == INT_MAX) {
+    std::fill(cluster_stamp.begin(), cluster_stamp.end(), 0);
+    cluster_gen = 0;
+  }
+  cluster_gen++;
+  int* stamp = cluster_stamp.data();
+  int* stack = cluster_stack.data();
+  int stack_size = 0;
   wolff_cluster.clear();
   int cluster_size = 0;
 
-  // create the stack
-  std::stack<int> stack;
-
   // choose a random site and add it to the cluster
   int s;
   do {
-    s = lattice->rng.RandInt(0, lattice->n_sites - 1);
+    s = chain_rng->rng.RandInt(0, lattice->n_sites - 1);
   } while (is_fixed[s]);
   cluster_size++;
   if (storeCluster) wolff_cluster.push_back(s);
-  is_clustered[s] = true;
-  stack.push(s);
+  stamp[s] = cluster_gen;
+  stack[stack_size++] = s;
 
-  while (stack.size() != 0) {
-    s = stack.top();
-    stack.pop();
+  while (stack_size != 0) {
+    s = stack[--stack_size];
 
     // flip the spin
     double value = phi[s];
     phi[s] = -value;
 
     // try to add neighbors
-    QfeSite* site = &lattice->sites[s];
-    for (int n = 0; n < site->nn; n++) {
-      int l = site->links[n];
-      double link_wt = lattice->links[l].wt;
-      s = site->neighbors[n];
+    double phi_sum = 0.0;  // neighbor values (for tracking the action)
+    int i_end = adj_offset[s + 1];
+    for (int i = adj_offset[s]; i < i_end; i++) {
+      int s_n = adj_sites[i];
+      phi_sum += phi[s_n] * adj_wt[i];
 
       // skip if the site is already clustered
-      if (is_clustered[s]) continue;
+      if (stamp[s_n] == cluster_gen) continue;
 
       // skip sites at dirichlet boundary
-      if (is_fixed[s]) continue;
+      if (is_fixed[s_n]) continue;
 
       // check if link is clustered
-      double rate = -2.0 * value * phi[s] * link_wt;
-      if (rate > 0.0 || lattice->rng.RandReal() < exp(rate)) continue;
+      double rate = -2.0 * value * phi[s_n] * adj_wt[i];
+      if (rate > 0.0 || chain_rng->rng.RandReal() < exp(rate)) continue;
 
       // add the site to the cluster
       cluster_size++;
-      if (storeCluster) wolff_cluster.push_back(s);
-      is_clustered[s] = true;
-      stack.push(s);
+      if (storeCluster) wolff_cluster.push_back(s_n);
+      stamp[s_n] = cluster_gen;
+      stack[stack_size++] = s_n;
+    }
+
+    if (tracking) {
+      // only the kinetic term changes
+      track_action += 2.0 * value * phi_sum;
+      track_mag -= 2.0 * value * lattice->sites[s].wt;
     }
   }
 
+  if (tracking) CountTrackedUpdate();
+  QFE_PROFILE_WORK(cluster_size);
   return cluster_size;
 }
 
@@ -268,6 +497,8 @@ int QfePhi4::WolffUpdate(bool storeCluster) {
 // ref: R.H. Swendsen and J.S. Wang, Phys. Rev. Lett. 58, 86 (1987)
 
 int QfePhi4::SWUpdate() {
+  QFE_PROFILE_SCOPE("QfePhi4::SWUpdate", "site-updates");
+  QFE_PROFILE_WORK(lattice->n_sites);
   // each site begins in its own cluster
   std::iota(std::begin(sw_root), std::end(sw_root), 0);
 
@@ -279,7 +510,7 @@ int QfePhi4::SWUpdate() {
 
     // check if link is clustered
     double rate = -2.0 * phi[s1] * phi[s2] * link_wt;
-    if (rate > 0.0 || lattice->rng.RandReal() < exp(rate)) continue;
+    if (rate > 0.0 || chain_rng->rng.RandReal() < exp(rate)) continue;
 
     // find the root node for each site
     int r1 = FindSWRoot(s1);
@@ -291,28 +522,97 @@ int QfePhi4::SWUpdate() {
     sw_root[r2] = r;
   }
 
-  std::unordered_map<int, int> sw_map;
-  std::vector<bool> is_flipped;
-  // sw_clusters.clear();
+  // the root of each cluster is its smallest site, so it is the first site
+  // of the cluster to be visited here
+  sw_flip.resize(lattice->n_sites);
   int n_clusters = 0;
   for (int s = 0; s < lattice->n_sites; s++) {
     // find the root node for this site
     int r = FindSWRoot(s);
-
-    if (sw_map.find(r) == sw_map.end()) {
-      sw_map[r] = n_clusters;
-      is_flipped.push_back(lattice->rng.RandBool());
-      // sw_clusters.push_back(std::vector<int>());
+    if (r == s) {
+      sw_flip[s] = chain_rng->rng.RandBool();
       n_clusters++;
     }
 
-    int c = sw_map[r];
-    // sw_clusters[c].push_back(s);
-
     // flip half the clusters
-    if (is_flipped[c]) phi[s] = -phi[s];
+    if (sw_flip[r]) phi[s] = -phi[s];
   }
 
+  if (tracking) SyncTracking();
+  return n_clusters;
+}
+
+// parallel swendsen-wang update. see QfeIsing::ParallelSWUpdate, which
+// works the same way.
+
+int QfePhi4::ParallelSWUpdate(int n_threads) {
+  QFE_PROFILE_SCOPE("QfePhi4::ParallelSWUpdate", "site-updates");
+  QFE_PROFILE_WORK(lattice->n_sites);
+  const QfeCounterRng& crng = chain_rng->counter_rng;
+  uint64_t sweep = chain_rng->counter_rng.sweep++;
+  lattice->SyncAdjacency();
+  const int* adj_offset = lattice->adj_offset.data();
+  const int* adj_sites = lattice->adj_sites.data();
+  const int* adj_links = lattice->adj_links.data();
+  const double* adj_wt = lattice->adj_wt.data();
+  int n_sites = lattice->n_sites;
+  int n_links = lattice->n_links;
+  int* root = sw_root.data();
+  sw_flip.resize(n_sites);
+
+  // each site begins in its own cluster
+  ParallelFor(n_sites, n_threads, [&](int s_begin, int s_end, int t) {
+    for (int s = s_begin; s < s_end; s++) root[s] = s;
+  });
+
+  // activate bonds and merge clusters. each link is handled from the end with
+  // the smaller index, using the stream of that link.
+  ParallelFor(n_sites, n_threads, [&](int s_begin, int s_end, int t) {
+    for (int s = s_begin; s < s_end; s++) {
+      for (int i = adj_offset[s]; i < adj_offset[s + 1]; i++) {
+        int s_n = adj_sites[i];
+        if (s_n < s) continue;
+
+        // check if link is clustered
+        double rate = -2.0 * phi[s] * phi[s_n] * adj_wt[i];
+        if (rate > 0.0) continue;
+        QfeRngStream rng(crng, sweep, adj_links[i]);
+        if (rng.RandReal() < exp(rate)) continue;
+
+        ConcurrentUnion(root, s, s_n);
+      }
+    }
+  });
+
+  // decide which clusters to flip
+  std::vector<int> thread_clusters(NumThreads(n_threads), 0);
+  ParallelFor(n_sites, n_threads, [&](int s_begin, int s_end, int t) {
+    for (int s = s_begin; s < s_end; s++) {
+      if (__atomic_load_n(&root[s], __ATOMIC_RELAXED) != s) continue;
+      QfeRngStream rng(crng, sweep, uint64_t(n_links) + s);
+      sw_flip[s] = rng.RandBool();
+      thread_clusters[t]++;
+    }
+  });
+
+  // flip half the clusters, and point every site directly at its root (as
+  // SWUpdate does) for SWClusterSusceptibility. the forest is only modified
+  // by the atomic path halving in ConcurrentFindRoot and by these stores,
+  // which never change any root. a halving step on root[s] that races with
+  // the store either fails or also sets it to the root.
+  ParallelFor(n_sites, n_threads, [&](int s_begin, int s_end, int t) {
+    for (int s = s_begin; s < s_end; s++) {
+      int r = ConcurrentFindRoot(root, s);
+      __atomic_store_n(&root[s], r, __ATOMIC_RELAXED);
+      if (sw_flip[r]) phi[s] = -phi[s];
+    }
+  });
+  if (tracking) SyncTracking();
+
+  int n_clusters = 0;
+  for (int t = 0; t < thread_clusters.size(); t++) {
+    n_clusters += thread_clusters[t];
+  }
   return n_clusters;
 }
 
@@ -333,6 +633,7 @@ int QfePhi4::FindSWRoot(int s) {
 }
 
 std::vector<double> QfePhi4::MInverse(double m0) {
+  QFE_PROFILE_SCOPE("QfePhi4::MInverse", "cg-iterations");
   std::vector<Eigen::Triplet<double>> M_elements;
 
   // add nearest-neighbor interaction terms
@@ -374,6 +675,7 @@ std::vector<double> QfePhi4::MInverse(double m0) {
       b(s) = 1.0;
       Eigen::VectorXd x = cg.solve(b);
       assert(cg.info() == Eigen::Success);
+      QFE_PROFILE_WORK(cg.iterations());
 
       // save M_inv in the map
       ct_map[wt_int] = x(s);
@@ -385,3 +687,104 @@ std::vector<double> QfePhi4::MInverse(double m0) {
 
   return M_inv;
 }
+
+// running totals of the action and the weighted moments of phi. metropolis,
+// overrelaxation, and wolff updates change the totals by the amount they
+// already compute for each changed site, so the Tracked* values can be
+// measured after every update at no cost. updates that change the whole field
+// anyway (swendsen-wang, parallel sweeps, hot/cold starts, reading a field)
+// recompute the totals exactly, and so does every interval-th tracked update
+// to bound the accumulated rounding error. call SyncTracking after changing
+// the couplings, counterterms, or link weights.
+
+void QfePhi4::StartTracking(int interval) {
+  tracking = true;
+  track_interval = interval;
+  SyncTracking();
+}
+
+void QfePhi4::StopTracking() { tracking = false; }
+
+void QfePhi4::SyncTracking() {
+  track_action = Action() * lattice->vol;
+  track_mag = 0.0;
+  track_phi2 = 0.0;
+  track_phi4 = 0.0;
+  for (int s = 0; s < lattice->n_sites; s++) {
+    double site_wt = lattice->sites[s].wt;
+    double phi2 = phi[s] * phi[s];
+    track_mag += phi[s] * site_wt;
+    track_phi2 += phi2 * site_wt;
+    track_phi4 += phi2 * phi2 * site_wt;
+  }
+  track_count = 0;
+}
+
+void QfePhi4::CountTrackedUpdate() {
+  track_count++;
+  if (track_count >= track_interval) SyncTracking();
+}
+
+double QfePhi4::TrackedAction() { return track_action / lattice->vol; }
+
+double QfePhi4::TrackedMeanPhi() { return track_mag / lattice->vol; }
+
+double QfePhi4::TrackedMeanPhi2() { return track_phi2 / lattice->vol; }
+
+double QfePhi4::TrackedMeanPhi4() { return track_phi4 / lattice->vol; }
+
+// improved estimators from the embedded ising clusters (see the QfeIsing
+// versions). for fixed |phi|, two sites are correlated only if they are in the
+// same cluster, and all sites in a cluster have the same sign. the wolff seed
+// site is chosen uniformly from the sites that are not fixed, so a cluster C
+// is chosen with probability |C| / n_free. WolffUpdate must be called with
+// storeCluster = true.
+
+double QfePhi4::ClusterSusceptibility() {
+  int n_free = 0;
+  for (int s = 0; s < lattice->n_sites; s++) {
+    if (!is_fixed[s]) n_free++;
+  }
+  double cluster_phi = 0.0;
+  for (int s : wolff_cluster) cluster_phi += phi[s] * lattice->sites[s].wt;
+  double n_cluster = double(wolff_cluster.size());
+  return double(n_free) * cluster_phi * cluster_phi /
+         (n_cluster * lattice->vol);
+}
+
+double QfePhi4::SWClusterSusceptibility() {
+  std::vector<double> root_phi(lattice->n_sites, 0.0);
+  for (int s = 0; s < lattice->n_sites; s++) {
+    root_phi[sw_root[s]] += phi[s] * lattice->sites[s].wt;
+  }
+  double sum = 0.0;
+  for (int s = 0; s < lattice->n_sites; s++) {
+    sum += root_phi[s] * root_phi[s];
+  }
+  return sum / lattice->vol;
+}
+
+template <typename Bin>
+void QfePhi4::MeasureClusterCorrelator(Bin bin,
+                                       std::vector<QfeMeasReal>& corr) {
+  int n_free = 0;
+  for (int s = 0; s < lattice->n_sites; s++) {
+    if (!is_fixed[s]) n_free++;
+  }
+
+  int n_bins = corr.size();
+  std::vector<double> corr_sum(n_bins, 0.0);
+  for (int s1 : wolff_cluster) {
+    double phi1 = phi[s1] * lattice->sites[s1].wt;
+    for (int s2 : wolff_cluster) {
+      int b = bin(s1, s2);
+      if (b < 0 || b >= n_bins) continue;
+      corr_sum[b] += phi1 * phi[s2] * lattice->sites[s2].wt;
+    }
+  }
+
+  double norm = double(n_free) / (double(wolff_cluster.size()) * lattice->vol);
+  for (int b = 0; b < n_bins; b++) {
+    corr[b].Measure(corr_sum[b] * norm);
+  }
+}
@@ -2,10 +2,18 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <cstdio>
 #include <sstream>
 #include <random>
 #include <string>
+#include <vector>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 class QfeRng {
 
@@ -17,8 +25,11 @@ public:
   double RandNormal(double mean = 0.0, double stddev = 1.0);
   int RandInt(int min, int max);
   bool RandBool();
+  void FillReal(double* out, int n, double min = 0.0, double max = 1.0);
+  void FillNormal(double* out, int n, double mean = 0.0, double stddev = 1.0);
 
   std::mt19937 gen;
+  std::vector<uint32_t> word_buf;  // raw generator output for bulk fills
 };
 
 void QfeRng::WriteRng(FILE* file){
@@ -62,3 +73,507 @@ bool QfeRng::RandBool() {
   std::uniform_int_distribution<int> dist(0, 1);
   return (dist(gen) == 1);
 }
+
+// convert pairs of random words to uniform random numbers in [min, max).
+// out[i] uses the 53 high bits of (w[2 * i] << 32) | w[2 * i + 1]. when
+// compiled with AVX-512 or AVX2 (e.g. -march=native), 8 or 4 numbers are
+// converted at once: the two parts of each 53-bit integer are converted
+// exactly with the 2^52 exponent trick and combined, so the results are
+// identical to the scalar loop.
+
+void WordsToReal(const uint32_t* w, double* out, int n, double min,
+                 double max) {
+  const double scale = (max - min) / 9007199254740992.0;  // 2^53
+  int i = 0;
+
+#if defined(__AVX512F__)
+  const __m512i lo32 = _mm512_set1_epi64(0xFFFFFFFF);
+  const __m512i magic = _mm512_set1_epi64(0x4330000000000000);  // 2^52
+  const __m512d two52 = _mm512_set1_pd(4503599627370496.0);
+  const __m512d two21 = _mm512_set1_pd(2097152.0);
+  const __m512d min_v = _mm512_set1_pd(min);
+  const __m512d scale_v = _mm512_set1_pd(scale);
+  for (; i + 8 <= n; i += 8) {
+    __m512i v = _mm512_loadu_si512((const void*) &w[2 * i]);
+    __m512i hi = _mm512_and_si512(v, lo32);  // w[2 * i]
+    __m512i lo = _mm512_maskz_srli_epi64(0xFF, v, 43);  // w[2i+1] >> 11
+    __m512d d_hi = _mm512_sub_pd(
+        _mm512_castsi512_pd(_mm512_or_si512(hi, magic)), two52);
+    __m512d d_lo = _mm512_sub_pd(
+        _mm512_castsi512_pd(_mm512_or_si512(lo, magic)), two52);
+    __m512d x = _mm512_add_pd(_mm512_mul_pd(d_hi, two21), d_lo);
+    _mm512_storeu_pd(&out[i], _mm512_add_pd(min_v, _mm512_mul_pd(x, scale_v)));
+  }
+#elif defined(__AVX2__)
+  const __m256i lo32 = _mm256_set1_epi64x(0xFFFFFFFF);
+  const __m256i magic = _mm256_set1_epi64x(0x4330000000000000);  // 2^52
+  const __m256d two52 = _mm256_set1_pd(4503599627370496.0);
+  const __m256d two21 = _mm256_set1_pd(2097152.0);
+  const __m256d min_v = _mm256_set1_pd(min);
+  const __m256d scale_v = _mm256_set1_pd(scale);
+  for (; i + 4 <= n; i += 4) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) &w[2 * i]);
+    __m256i hi = _mm256_and_si256(v, lo32);  // w[2 * i]
+    __m256i lo = _mm256_srli_epi64(v, 43);   // w[2 * i + 1] >> 11
+    __m256d d_hi = _mm256_sub_pd(
+        _mm256_castsi256_pd(_mm256_or_si256(hi, magic)), two52);
+    __m256d d_lo = _mm256_sub_pd(
+        _mm256_castsi256_pd(_mm256_or_si256(lo, magic)), two52);
+    __m256d x = _mm256_add_pd(_mm256_mul_pd(d_hi, two21), d_lo);
+    _mm256_storeu_pd(&out[i], _mm256_add_pd(min_v, _mm256_mul_pd(x, scale_v)));
+  }
+#endif
+
+  for (; i < n; i++) {
+    uint64_t x = (uint64_t(w[2 * i]) << 32) | w[2 * i + 1];
+    out[i] = min + double(x >> 11) * scale;
+  }
+}
+
+// fill out[0..n) with uniform random numbers in [min, max). the raw 32-bit
+// words are drawn first and then converted in a separate loop with no
+// distribution objects (see WordsToReal). each number uses 53 random bits
+// from two words. the mersenne twister itself is sequential, so drawing the
+// words can't be vectorized.
+
+void QfeRng::FillReal(double* out, int n, double min, double max) {
+  word_buf.resize(2 * n);
+  uint32_t* w = word_buf.data();
+  for (int i = 0; i < 2 * n; i++) w[i] = gen();
+  WordsToReal(w, out, n, min, max);
+}
+
+// ziggurat tables for the standard normal distribution with 128 layers
+// ref: G. Marsaglia and W. W. Tsang, J. Stat. Softw. 5, 8 (2000).
+// J. A. Doornik, "An Improved Ziggurat Method to Generate Normal Random
+// Samples" (2005).
+
+struct QfeZigguratTable {
+  QfeZigguratTable();
+
+  static constexpr double R = 3.442619855899;  // start of the tail
+  static constexpr double V = 9.91256303526217e-3;  // area of each layer
+  double x[129];  // right edge of each layer
+  double ratio[128];  // x[i + 1] / x[i]
+};
+
+QfeZigguratTable::QfeZigguratTable() {
+  double f = exp(-0.5 * R * R);
+  x[0] = V / f;
+  x[1] = R;
+  x[128] = 0.0;
+  for (int i = 2; i < 128; i++) {
+    x[i] = sqrt(-2.0 * log(V / x[i - 1] + f));
+    f = exp(-0.5 * x[i] * x[i]);
+  }
+  for (int i = 0; i < 128; i++) ratio[i] = x[i + 1] / x[i];
+}
+
+// fill out[0..n) with normally distributed random numbers using the ziggurat
+// method. about 99% of the samples need one 64-bit draw and no
+// transcendental functions. there is no vector path: the words come from the
+// sequential mersenne twister, and the number of words used by each sample
+// depends on whether it is rejected, so a vector version would either
+// change the stream or spend most of its time resolving rejections.
+
+void QfeRng::FillNormal(double* out, int n, double mean, double stddev) {
+  static const QfeZigguratTable zig;
+  const double scale = 1.0 / 9007199254740992.0;  // 2^-53
+
+  for (int j = 0; j < n; j++) {
+    double z;
+    while (true) {
+      uint64_t bits = (uint64_t(gen()) << 32) | gen();
+      int i = bits & 0x7F;  // layer
+      double u = 2.0 * double(bits >> 11) * scale - 1.0;  // (-1, 1)
+
+      // inside the rectangular part of the layer
+      if (fabs(u) < zig.ratio[i]) {
+        z = u * zig.x[i];
+        break;
+      }
+
+      // sample from the tail beyond R
+      if (i == 0) {
+        double a, b;
+        do {
+          a = log(1.0 - double(gen() >> 5) / 134217728.0) / zig.R;  // 2^27
+          b = log(1.0 - double(gen() >> 5) / 134217728.0);
+        } while (-2.0 * b < a * a);
+        z = (u < 0.0) ? a - zig.R : zig.R - a;
+        break;
+      }
+
+      // wedge between the layer and the density curve
+      double xx = u * zig.x[i];
+      double f0 = exp(-0.5 * (zig.x[i] * zig.x[i] - xx * xx));
+      double f1 = exp(-0.5 * (zig.x[i + 1] * zig.x[i + 1] - xx * xx));
+      if (f1 + double(gen()) / 4294967296.0 * (f0 - f1) < 1.0) {
+        z = xx;
+        break;
+      }
+    }
+    out[j] = mean + stddev * z;
+  }
+}
+
+// counter-based random number generator (Philox4x32-10). each random number
+// is a pure function of the seed and a 128-bit counter, which we split into a
+// sweep index, a stream index (normally the site index), and a draw index
+// within that stream. updates that draw from the stream of the site they are
+// updating therefore produce the same Markov chain regardless of the order in
+// which the sites are visited or the number of threads, and the generator
+// state is just the seed plus the sweep index.
+// ref: J. K. Salmon, et al., SC '11, 16 (2011).
+
+class QfeCounterRng {
+
+public:
+  QfeCounterRng(uint64_t seed = 12345678);
+  void WriteRng(FILE* file);
+  void ReadRng(FILE* file);
+  void Block(uint64_t sweep, uint64_t stream, uint32_t block,
+             uint32_t out[4]) const;
+  void Blocks(uint64_t sweep, uint64_t stream, uint32_t first, int n_blocks,
+              uint32_t* out) const;
+  void FillReal(uint64_t sweep, uint64_t stream, double* out, int n,
+                double min = 0.0, double max = 1.0) const;
+  void FillNormal(uint64_t sweep, uint64_t stream, double* out, int n,
+                  double mean = 0.0, double stddev = 1.0) const;
+
+  uint64_t seed;
+  uint64_t sweep;  // current sweep index
+};
+
+// sequence of random numbers from a single (sweep, stream) pair of a counter
+// based generator, with the same interface as QfeRng
+
+class QfeRngStream {
+
+public:
+  QfeRngStream(const QfeCounterRng& crng, uint64_t sweep, uint64_t stream);
+  uint64_t Next();
+  double RandReal(double min = 0.0, double max = 1.0);
+  double RandNormal(double mean = 0.0, double stddev = 1.0);
+  int RandInt(int min, int max);
+  bool RandBool();
+
+  const QfeCounterRng* crng;
+  uint64_t sweep;
+  uint64_t stream;
+  uint32_t block;   // index of the next block of 4 random words
+  uint32_t buf[4];  // current block
+  int i_buf;        // next unused pair of words in buf (2 when empty)
+};
+
+QfeCounterRng::QfeCounterRng(uint64_t seed) {
+  this->seed = seed;
+  sweep = 0;
+}
+
+void QfeCounterRng::WriteRng(FILE* file) {
+  fprintf(file, "%llu %llu\n", (unsigned long long) seed,
+          (unsigned long long) sweep);
+}
+
+void QfeCounterRng::ReadRng(FILE* file) {
+  unsigned long long seed_in;
+  unsigned long long sweep_in;
+  fscanf(file, "%llu %llu\n", &seed_in, &sweep_in);
+  seed = seed_in;
+  sweep = sweep_in;
+}
+
+// generate the 4 random words for counter (block, stream, sweep)
+
+void QfeCounterRng::Block(uint64_t sweep, uint64_t stream, uint32_t block,
+                          uint32_t out[4]) const {
+  const uint32_t M0 = 0xD2511F53;
+  const uint32_t M1 = 0xCD9E8D57;
+  const uint32_t W0 = 0x9E3779B9;
+  const uint32_t W1 = 0xBB67AE85;
+
+  uint32_t c0 = block;
+  uint32_t c1 = uint32_t(stream);
+  uint32_t c2 = uint32_t(sweep);
+  uint32_t c3 = uint32_t(sweep >> 32) ^ uint32_t(stream >> 32);
+  uint32_t k0 = uint32_t(seed);
+  uint32_t k1 = uint32_t(seed >> 32);
+
+  for (int r = 0; r < 10; r++) {
+    uint64_t p0 = uint64_t(M0) * c0;
+    uint64_t p1 = uint64_t(M1) * c2;
+    uint32_t n0 = uint32_t(p1 >> 32) ^ c1 ^ k0;
+    uint32_t n1 = uint32_t(p1);
+    uint32_t n2 = uint32_t(p0 >> 32) ^ c3 ^ k1;
+    uint32_t n3 = uint32_t(p0);
+    c0 = n0;
+    c1 = n1;
+    c2 = n2;
+    c3 = n3;
+    k0 += W0;
+    k1 += W1;
+  }
+
+  out[0] = c0;
+  out[1] = c1;
+  out[2] = c2;
+  out[3] = c3;
+}
+
+// generate blocks first .. first + n_blocks - 1 of the stream (sweep, stream)
+// into out[0..4 * n_blocks). the blocks are independent, so with AVX-512 or
+// AVX2 the rounds are computed for 8 or 4 blocks at once, one block per
+// 64-bit lane (the 32x32 -> 64 bit products map onto mul_epu32).
+
+void QfeCounterRng::Blocks(uint64_t sweep, uint64_t stream, uint32_t first,
+                           int n_blocks, uint32_t* out) const {
+  int b = 0;
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+  const uint32_t M0 = 0xD2511F53;
+  const uint32_t M1 = 0xCD9E8D57;
+  const uint32_t W0 = 0x9E3779B9;
+  const uint32_t W1 = 0xBB67AE85;
+#endif
+
+#if defined(__AVX512F__)
+  // the maskz forms of mul_epu32 and srli_epi64 (with all lanes enabled)
+  // avoid a spurious -Wmaybe-uninitialized from the unmasked forms in gcc 12
+  const __m512i lo32 = _mm512_set1_epi64(0xFFFFFFFF);
+  const __m512i m0 = _mm512_set1_epi64(M0);
+  const __m512i m1 = _mm512_set1_epi64(M1);
+  for (; b + 8 <= n_blocks; b += 8) {
+    __m512i c0 = _mm512_set_epi64(uint32_t(first + b + 7),
+                                  uint32_t(first + b + 6),
+                                  uint32_t(first + b + 5),
+                                  uint32_t(first + b + 4),
+                                  uint32_t(first + b + 3),
+                                  uint32_t(first + b + 2),
+                                  uint32_t(first + b + 1),
+                                  uint32_t(first + b));
+    __m512i c1 = _mm512_set1_epi64(uint32_t(stream));
+    __m512i c2 = _mm512_set1_epi64(uint32_t(sweep));
+    __m512i c3 = _mm512_set1_epi64(uint32_t(sweep >> 32) ^
+                                   uint32_t(stream >> 32));
+    uint32_t k0 = uint32_t(seed);
+    uint32_t k1 = uint32_t(seed >> 32);
+    for (int r = 0; r < 10; r++) {
+      __m512i p0 = _mm512_maskz_mul_epu32(0xFF, m0, c0);
+      __m512i p1 = _mm512_maskz_mul_epu32(0xFF, m1, c2);
+      __m512i key0 = _mm512_set1_epi64(k0);
+      __m512i key1 = _mm512_set1_epi64(k1);
+      __m512i n0 = _mm512_xor_si512(_mm512_maskz_srli_epi64(0xFF, p1, 32),
+                                    _mm512_xor_si512(c1, key0));
+      __m512i n2 = _mm512_xor_si512(_mm512_maskz_srli_epi64(0xFF, p0, 32),
+                                    _mm512_xor_si512(c3, key1));
+      c0 = n0;
+      c1 = _mm512_and_si512(p1, lo32);
+      c2 = n2;
+      c3 = _mm512_and_si512(p0, lo32);
+      k0 += W0;
+      k1 += W1;
+    }
+    uint64_t c[4][8];
+    _mm512_storeu_si512((void*) c[0], c0);
+    _mm512_storeu_si512((void*) c[1], c1);
+    _mm512_storeu_si512((void*) c[2], c2);
+    _mm512_storeu_si512((void*) c[3], c3);
+    for (int j = 0; j < 8; j++) {
+      for (int k = 0; k < 4; k++) out[4 * (b + j) + k] = uint32_t(c[k][j]);
+    }
+  }
+#elif defined(__AVX2__)
+  const __m256i lo32 = _mm256_set1_epi64x(0xFFFFFFFF);
+  const __m256i m0 = _mm256_set1_epi64x(M0);
+  const __m256i m1 = _mm256_set1_epi64x(M1);
+  for (; b + 4 <= n_blocks; b += 4) {
+    __m256i c0 = _mm256_set_epi64x(uint32_t(first + b + 3),
+                                   uint32_t(first + b + 2),
+                                   uint32_t(first + b + 1),
+                                   uint32_t(first + b));
+    __m256i c1 = _mm256_set1_epi64x(uint32_t(stream));
+    __m256i c2 = _mm256_set1_epi64x(uint32_t(sweep));
+    __m256i c3 = _mm256_set1_epi64x(uint32_t(sweep >> 32) ^
+                                    uint32_t(stream >> 32));
+    uint32_t k0 = uint32_t(seed);
+    uint32_t k1 = uint32_t(seed >> 32);
+    for (int r = 0; r < 10; r++) {
+      __m256i p0 = _mm256_mul_epu32(m0, c0);
+      __m256i p1 = _mm256_mul_epu32(m1, c2);
+      __m256i key0 = _mm256_set1_epi64x(k0);
+      __m256i key1 = _mm256_set1_epi64x(k1);
+      __m256i n0 = _mm256_xor_si256(_mm256_srli_epi64(p1, 32),
+                                    _mm256_xor_si256(c1, key0));
+      __m256i n2 = _mm256_xor_si256(_mm256_srli_epi64(p0, 32),
+                                    _mm256_xor_si256(c3, key1));
+      c0 = n0;
+      c1 = _mm256_and_si256(p1, lo32);
+      c2 = n2;
+      c3 = _mm256_and_si256(p0, lo32);
+      k0 += W0;
+      k1 += W1;
+    }
+    uint64_t c[4][4];
+    _mm256_storeu_si256((__m256i*) c[0], c0);
+    _mm256_storeu_si256((__m256i*) c[1], c1);
+    _mm256_storeu_si256((__m256i*) c[2], c2);
+    _mm256_storeu_si256((__m256i*) c[3], c3);
+    for (int j = 0; j < 4; j++) {
+      for (int k = 0; k < 4; k++) out[4 * (b + j) + k] = uint32_t(c[k][j]);
+    }
+  }
+#endif
+
+  for (; b < n_blocks; b++) Block(sweep, stream, first + b, &out[4 * b]);
+}
+
+// number of blocks generated at a time by FillReal and FillNormal
+#define QFE_RNG_FILL_BLOCKS 64
+
+// fill out[0..n) with uniform random numbers in [min, max) from the stream
+// (sweep, stream). these are the same numbers returned by successive calls to
+// QfeRngStream::RandReal. the blocks are generated a chunk at a time with
+// Blocks and converted with WordsToReal.
+
+void QfeCounterRng::FillReal(uint64_t sweep, uint64_t stream, double* out,
+                             int n, double min, double max) const {
+  uint32_t w[4 * QFE_RNG_FILL_BLOCKS];
+  for (int i = 0; i < n; i += 2 * QFE_RNG_FILL_BLOCKS) {
+    int n_out = std::min(n - i, 2 * QFE_RNG_FILL_BLOCKS);
+    Blocks(sweep, stream, i / 2, (n_out + 1) / 2, w);
+    WordsToReal(w, &out[i], n_out, min, max);
+  }
+}
+
+// fill out[0..n) with normally distributed random numbers from the stream
+// (sweep, stream) using the Box-Muller transform on pairs of uniforms. the
+// blocks are generated with Blocks, but the transform itself is scalar since
+// there are no vector versions of log, sin, and cos in the standard library.
+
+void QfeCounterRng::FillNormal(uint64_t sweep, uint64_t stream, double* out,
+                               int n, double mean, double stddev) const {
+  const double scale = 1.0 / 9007199254740992.0;  // 2^-53
+  uint32_t w[4 * QFE_RNG_FILL_BLOCKS];
+  for (int i0 = 0; i0 < n; i0 += 2 * QFE_RNG_FILL_BLOCKS) {
+    int n_blocks = std::min((n - i0 + 1) / 2, QFE_RNG_FILL_BLOCKS);
+    Blocks(sweep, stream, i0 / 2, n_blocks, w);
+    for (int b = 0; b < n_blocks; b++) {
+      int i = i0 + 2 * b;
+      uint64_t x0 = (uint64_t(w[4 * b]) << 32) | w[4 * b + 1];
+      uint64_t x1 = (uint64_t(w[4 * b + 2]) << 32) | w[4 * b + 3];
+      double u1 = (double(x0 >> 11) + 0.5) * scale;  // (0, 1)
+      double u2 = double(x1 >> 11) * scale;
+      double rad = stddev * sqrt(-2.0 * log(u1));
+      out[i] = mean + rad * cos(2.0 * M_PI * u2);
+      if (i + 1 < n) out[i + 1] = mean + rad * sin(2.0 * M_PI * u2);
+    }
+  }
+}
+
+QfeRngStream::QfeRngStream(const QfeCounterRng& crng, uint64_t sweep,
+                           uint64_t stream) {
+  this->crng = &crng;
+  this->sweep = sweep;
+  this->stream = stream;
+  block = 0;
+  i_buf = 2;
+}
+
+// next 64 random bits from the stream
+
+uint64_t QfeRngStream::Next() {
+  if (i_buf == 2) {
+    crng->Block(sweep, stream, block++, buf);
+    i_buf = 0;
+  }
+  uint64_t x = (uint64_t(buf[2 * i_buf]) << 32) | buf[2 * i_buf + 1];
+  i_buf++;
+  return x;
+}
+
+double QfeRngStream::RandReal(double min, double max) {
+  double u = double(Next() >> 11) / 9007199254740992.0;  // 2^53
+  return min + u * (max - min);
+}
+
+double QfeRngStream::RandNormal(double mean, double stddev) {
+  double u1 = (double(Next() >> 11) + 0.5) / 9007199254740992.0;
+  double u2 = double(Next() >> 11) / 9007199254740992.0;
+  return mean + stddev * sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+int QfeRngStream::RandInt(int min, int max) {
+  // rejection sampling to avoid modulo bias
+  uint64_t range = uint64_t(int64_t(max) - int64_t(min)) + 1;
+  uint64_t limit = UINT64_MAX - UINT64_MAX % range;
+  uint64_t x;
+  do {
+    x = Next();
+  } while (x >= limit);
+  return int(int64_t(min) + int64_t(x % range));
+}
+
+bool QfeRngStream::RandBool() {
+  return (Next() >> 63) == 1;
+}
+
+// random number generators of a single Markov chain: a sequential generator,
+// the block streams used by parallel sweeps (seeded from rng on first use),
+// and a counter-based generator. QfeLattice inherits a default set that is
+// shared by every field on the lattice. Independent chains on the same
+// lattice should each have their own set (see QfeIsing::SetRng).
+
+class QfeChainRng {
+
+public:
+  QfeChainRng(unsigned int seed = 12345678);
+  void SeedRng(unsigned int seed);
+  void WriteRng(FILE* file);
+  void ReadRng(FILE* file);
+
+  QfeRng rng;
+  std::vector<QfeRng> block_rng;  // random number stream for each site block
+  QfeCounterRng counter_rng;  // generator for parallel sweeps
+  bool use_counter_rng;       // use counter_rng instead of block_rng
+};
+
+QfeChainRng::QfeChainRng(unsigned int seed) {
+  SeedRng(seed);
+  use_counter_rng = false;
+}
+
+// reset and seed all of the generators
+
+void QfeChainRng::SeedRng(unsigned int seed) {
+  rng = QfeRng(seed);
+  block_rng.clear();
+  counter_rng = QfeCounterRng(seed);
+}
+
+// write the state of every generator (one per line) so that a chain can be
+// continued exactly
+
+void QfeChainRng::WriteRng(FILE* file) {
+  rng.WriteRng(file);
+  fprintf(file, "\n");
+  counter_rng.WriteRng(file);
+  fprintf(file, "%d %d\n", int(use_counter_rng), int(block_rng.size()));
+  for (int b = 0; b < block_rng.size(); b++) {
+    block_rng[b].WriteRng(file);
+    fprintf(file, "\n");
+  }
+}
+
+void QfeChainRng::ReadRng(FILE* file) {
+  rng.ReadRng(file);
+  counter_rng.ReadRng(file);
+  int use_counter_in = 0;
+  int n_blocks = 0;
+  fscanf(file, "%d %d\n", &use_counter_in, &n_blocks);
+  use_counter_rng = use_counter_in;
+  block_rng.resize(n_blocks);
+  for (int b = 0; b < n_blocks; b++) {
+    block_rng[b].ReadRng(file);
+  }
+}
@@ -0,0 +1,137 @@
+// runner.h
+
+#pragma once
+
+#include <cassert>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "lattice.h"
+#include "parallel.h"
+#include "rng.h"
+#include "util.h"
+
+/// @brief Independent Markov chains with different seeds on one shared,
+/// read-only lattice. Each chain is a field with its own random number
+/// generators (see QfeChainRng), so a large lattice only needs to be built
+/// once, and the chains can be run concurrently on a pool of threads. A chain
+/// with a given seed produces the same results as a single field on a lattice
+/// seeded with lattice.SeedRng(seed). Per-chain files use the same layout as
+/// the examples: data_dir/run_id/run_id_<name>_<seed>.dat.
+template <class Field>
+class QfeChainRunner {
+ public:
+  template <typename Make>
+  QfeChainRunner(QfeLattice* lattice, const std::vector<unsigned int>& seeds,
+                 Make make);
+  template <typename Update>
+  void Run(Update update, int n_threads = 0);
+  std::string Path(int c, const std::string& name);
+  bool Load(int c);
+  bool Save(int c);
+
+  int n_chains;
+  std::vector<unsigned int> seeds;  // seed of each chain
+  std::vector<QfeChainRng> rngs;    // generators of each chain
+  std::vector<Field> chains;        // field of each chain
+  std::string data_dir;             // directory for per-chain files
+  std::string run_id;               // subdirectory and file name prefix
+};
+
+/// @brief Chain runner constructor
+/// @param lattice Lattice shared by the chains (must not be modified while
+/// the chains are in use)
+/// @param seeds Random seed for each chain
+/// @param make Function that returns a field given a lattice, e.g.
+/// [](QfeLattice* l) { return QfeIsing(l, beta); }
+template <class Field>
+template <typename Make>
+QfeChainRunner<Field>::QfeChainRunner(QfeLattice* lattice,
+                                      const std::vector<unsigned int>& seeds,
+                                      Make make) {
+  n_chains = seeds.size();
+  this->seeds = seeds;
+  data_dir = ".";
+  run_id = "chain";
+
+  // the lattice is read concurrently by the chains, so build the adjacency
+  // and coloring now. the generators must not move once the fields point to
+  // them.
+  lattice->SyncAdjacency();
+  lattice->SyncColoring();
+  rngs.resize(n_chains);
+  chains.reserve(n_chains);
+  for (int c = 0; c < n_chains; c++) {
+    rngs[c].SeedRng(seeds[c]);
+    rngs[c].use_counter_rng = lattice->use_counter_rng;
+    chains.push_back(make(lattice));
+    chains[c].SetRng(&rngs[c]);
+  }
+}
+
+/// @brief Run all chains on @p n_threads threads. The update function is
+/// called as update(field, c) for each chain c, and may run any number of
+/// updates and measurements (e.g. an entire simulation). It should only use
+/// the field's own generators, and should not modify the lattice. The results
+/// do not depend on the number of threads.
+/// @param update Function that runs a single chain
+/// @param n_threads Number of threads (0 for one per core)
+template <class Field>
+template <typename Update>
+void QfeChainRunner<Field>::Run(Update update, int n_threads) {
+  ParallelFor(n_chains, n_threads, [&](int c_begin, int c_end, int t) {
+    for (int c = c_begin; c < c_end; c++) update(chains[c], c);
+  });
+}
+
+/// @brief Path of a per-chain file, e.g. Path(c, "bulk") is
+/// data_dir/run_id/run_id_bulk_<seed>.dat
+template <class Field>
+std::string QfeChainRunner<Field>::Path(int c, const std::string& name) {
+  return string_format("%s/%s/%s_%s_%08X.dat", data_dir.c_str(),
+                       run_id.c_str(), run_id.c_str(), name.c_str(), seeds[c]);
+}
+
+/// @brief Load the generators and field of chain @p c from the "rng" and
+/// "field" files written by Save, if they exist
+/// @return True if the field was loaded
+template <class Field>
+bool QfeChainRunner<Field>::Load(int c) {
+  FILE* rng_file = fopen(Path(c, "rng").c_str(), "r");
+  if (rng_file != nullptr) {
+    rngs[c].ReadRng(rng_file);
+    fclose(rng_file);
+  }
+
+  FILE* field_file = fopen(Path(c, "field").c_str(), "rb");
+  if (field_file == nullptr) return false;
+  chains[c].ReadField(field_file);
+  fclose(field_file);
+  return true;
+}
+
+/// @brief Save the generators and field of chain @p c. The directory
+/// data_dir/run_id must exist.
+/// @return True if both files were written
+template <class Field>
+bool QfeChainRunner<Field>::Save(int c) {
+  std::string rng_path = Path(c, "rng");
+  FILE* rng_file = fopen(rng_path.c_str(), "w");
+  if (rng_file == nullptr) {
+    fprintf(stderr, "unable to open rng file: %s\n", rng_path.c_str());
+    return false;
+  }
+  rngs[c].WriteRng(rng_file);
+  fclose(rng_file);
+
+  std::string field_path = Path(c, "field");
+  FILE* field_file = fopen(field_path.c_str(), "wb");
+  if (field_file == nullptr) {
+    fprintf(stderr, "unable to open field file: %s\n", field_path.c_str());
+    return false;
+  }
+  chains[c].WriteField(field_file);
+  fclose(field_file);
+  return true;
+}
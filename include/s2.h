@@ -33,6 +33,8 @@ class QfeLatticeS2 : public QfeLattice {
   void ReadBaseLattice(int q);
   void WriteSite(FILE* file, int s);
   void ReadSite(FILE* file, int s);
+  void WriteBinaryData(std::vector<char>& buf);
+  bool ReadBinaryData(const char*& data, const char* end);
   int CreateOrbit(double xi1, double xi2);
   Vec3 CalcOrbitPos(int o);
   void ReadOrbits(FILE* file);
@@ -40,6 +42,7 @@ class QfeLatticeS2 : public QfeLattice {
   void UpdateOrbits();
   void ReadSymmetryData(int q, int k);
   void ResizeSites(int n_sites);
+  void PermuteSites(const std::vector<int>& new_index);
   void Inflate();
   void UpdateAntipodes();
   Vec3 FaceCircumcenter(int f);
@@ -317,6 +320,40 @@ void QfeLatticeS2::ReadSite(FILE* file, int s) {
   if (AlmostEq(r[s], south_pole)) r[s] = south_pole;
 }
 
+/// @brief Append the lattice arrays and S2 coordinate, orbit, and symmetry
+/// data to a binary buffer
+/// @param buf Binary buffer
+void QfeLatticeS2::WriteBinaryData(std::vector<char>& buf) {
+  QfeLattice::WriteBinaryData(buf);
+  BinaryAppend(buf, &q, 1);
+  BinaryAppend(buf, first_face_r, 4);
+  BinaryAppend(buf, r);
+  BinaryAppend(buf, antipode);
+  BinaryAppend(buf, site_orbit);
+  BinaryAppend(buf, face_orbit);
+  BinaryAppend(buf, orbit_xi);
+  BinaryAppend(buf, G);
+  BinaryAppend(buf, site_g);
+}
+
+/// @brief Read the arrays written by WriteBinaryData
+/// @param data Binary data (advanced past the arrays that were read)
+/// @param end End of the binary data
+/// @return false if the data is inconsistent
+bool QfeLatticeS2::ReadBinaryData(const char*& data, const char* end) {
+  if (!QfeLattice::ReadBinaryData(data, end)) return false;
+  if (!BinaryExtract(data, end, &q, 1)) return false;
+  if (!BinaryExtract(data, end, first_face_r, 4)) return false;
+  if (!BinaryExtract(data, end, r)) return false;
+  if (!BinaryExtract(data, end, antipode)) return false;
+  if (!BinaryExtract(data, end, site_orbit)) return false;
+  if (!BinaryExtract(data, end, face_orbit)) return false;
+  if (!BinaryExtract(data, end, orbit_xi)) return false;
+  if (!BinaryExtract(data, end, G)) return false;
+  if (!BinaryExtract(data, end, site_g)) return false;
+  return r.size() == n_sites && site_g.size() == n_sites;
+}
+
 /// @brief Create an orbit
 /// @param xi1 1st barycentric coordinate
 /// @param xi2 2nd barycentric coordinate
@@ -515,6 +552,20 @@ void QfeLatticeS2::ResizeSites(int n_sites) {
   site_orbit.resize(n_sites);
 }
 
+/// @brief Move each site to a new index (see QfeLattice::Reorder)
+/// @param new_index New index for each site
+void QfeLatticeS2::PermuteSites(const std::vector<int>& new_index) {
+  QfeLattice::PermuteSites(new_index);
+  PermuteArray(r, new_index);
+  PermuteArray(ylm, new_index);
+  PermuteArray(antipode, new_index);
+  PermuteArray(site_orbit, new_index);
+  PermuteArray(site_g, new_index);
+  for (int s = 0; s < n_sites; s++) {
+    antipode[s] = new_index[antipode[s]];
+  }
+}
+
 /// @brief Project all site coordinates onto a unit sphere.
 void QfeLatticeS2::Inflate() {
   for (int s = 0; s < n_sites; s++) {
@@ -658,6 +709,9 @@ void QfeLatticeS2::UpdateWeights() {
   for (int f = 0; f < n_faces; f++) {
     faces[f].wt /= face_wt_norm;
   }
+
+  // link weights have changed
+  adj_valid = false;
 }
 
 /// @brief Calculate the global effective lattice spacing
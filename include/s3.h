@@ -26,8 +26,11 @@ class QfeLatticeS3 : public QfeLattice {
   QfeLatticeS3(int q, int k = 1);
   void ReadBaseLattice(int q);
   void ResizeSites(int n_sites);
+  void PermuteSites(const std::vector<int>& new_index);
   void WriteSite(FILE* file, int s);
   void ReadSite(FILE* file, int s);
+  void WriteBinaryData(std::vector<char>& buf);
+  bool ReadBinaryData(const char*& data, const char* end);
   int CreateOrbit(double xi1, double xi2, double xi3);
   Vec4 CalcOrbitPos(int id);
   void ReadOrbits(FILE* file);
@@ -320,6 +323,19 @@ void QfeLatticeS3::ResizeSites(int n_sites) {
   site_orbit.resize(n_sites);
 }
 
+/// @brief Move each site to a new index (see QfeLattice::Reorder)
+/// @param new_index New index for each site
+void QfeLatticeS3::PermuteSites(const std::vector<int>& new_index) {
+  QfeLattice::PermuteSites(new_index);
+  PermuteArray(r, new_index);
+  PermuteArray(antipode, new_index);
+  PermuteArray(site_orbit, new_index);
+  PermuteArray(site_g, new_index);
+  for (int s = 0; s < n_sites; s++) {
+    antipode[s] = new_index[antipode[s]];
+  }
+}
+
 /// @brief Write a site to a lattice file
 /// @param file Lattice file
 /// @param s Site index
@@ -357,6 +373,40 @@ void QfeLatticeS3::ReadSite(FILE* file, int s) {
   if (AlmostEq(r[s], south_pole)) r[s] = south_pole;
 }
 
+/// @brief Append the lattice arrays and S3 coordinate, orbit, and symmetry
+/// data to a binary buffer
+/// @param buf Binary buffer
+void QfeLatticeS3::WriteBinaryData(std::vector<char>& buf) {
+  QfeLattice::WriteBinaryData(buf);
+  BinaryAppend(buf, &q, 1);
+  BinaryAppend(buf, first_cell_r, 4);
+  BinaryAppend(buf, r);
+  BinaryAppend(buf, antipode);
+  BinaryAppend(buf, site_orbit);
+  BinaryAppend(buf, cell_orbit);
+  BinaryAppend(buf, orbit_xi);
+  BinaryAppend(buf, G);
+  BinaryAppend(buf, site_g);
+}
+
+/// @brief Read the arrays written by WriteBinaryData
+/// @param data Binary data (advanced past the arrays that were read)
+/// @param end End of the binary data
+/// @return false if the data is inconsistent
+bool QfeLatticeS3::ReadBinaryData(const char*& data, const char* end) {
+  if (!QfeLattice::ReadBinaryData(data, end)) return false;
+  if (!BinaryExtract(data, end, &q, 1)) return false;
+  if (!BinaryExtract(data, end, first_cell_r, 4)) return false;
+  if (!BinaryExtract(data, end, r)) return false;
+  if (!BinaryExtract(data, end, antipode)) return false;
+  if (!BinaryExtract(data, end, site_orbit)) return false;
+  if (!BinaryExtract(data, end, cell_orbit)) return false;
+  if (!BinaryExtract(data, end, orbit_xi)) return false;
+  if (!BinaryExtract(data, end, G)) return false;
+  if (!BinaryExtract(data, end, site_g)) return false;
+  return r.size() == n_sites && site_g.size() == n_sites;
+}
+
 /// @brief Create an orbit
 /// @param xi1 1st barycentric coordinate
 /// @param xi2 2nd barycentric coordinate
@@ -680,6 +730,9 @@ void QfeLatticeS3::CalcFEMWeights() {
   // normalize cell volume
   double cell_norm = cell_vol / double(n_cells);
   for (int c = 0; c < n_cells; c++) cells[c].wt /= cell_norm;
+
+  // link weights have changed
+  adj_valid = false;
 }
 
 /// @brief Calculate the global effective lattice spacing
@@ -2,15 +2,59 @@
 
 #pragma once
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
 #include <cmath>
 #include <complex>
-#include <deque>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
 #include <vector>
 
+#include "parallel.h"
+#include "rng.h"
+
 typedef std::complex<double> Complex;
 
 double AutocorrTime(std::vector<double>& a);
 
+// add a value to a running mean and sum of squared deviations (welford)
+
+void WelfordAdd(double value, double& mean, double& m2, int& n) {
+  n++;
+  double delta = value - mean;
+  mean += delta / double(n);
+  m2 += delta * (value - mean);
+}
+
+// combine two running means and sums of squared deviations. the result is
+// the same as adding the values of b after the values of a, up to rounding.
+// ref: T. F. Chan, G. H. Golub, and R. J. LeVeque, Am. Stat. 37, 242 (1983).
+
+void WelfordMerge(double mean_b, double m2_b, int n_b, double& mean,
+                  double& m2, int& n) {
+  if (n_b == 0) return;
+  if (n == 0) {
+    mean = mean_b;
+    m2 = m2_b;
+    n = n_b;
+    return;
+  }
+  double n_a = double(n);
+  double n_ab = n_a + double(n_b);
+  double delta = mean_b - mean;
+  mean += delta * double(n_b) / n_ab;
+  m2 += m2_b + delta * delta * n_a * double(n_b) / n_ab;
+  n += n_b;
+}
+
 class QfeMeasReal {
 
 public:
@@ -19,69 +63,201 @@ public:
   void ReadMeasurement(FILE* file);
   void Reset();
   void Measure(double value, bool calc_autocorr = true);
+  void Merge(const QfeMeasReal& other);
   double Mean();
+  double Sum();
+  double Sum2();
   double Error();
   double AutocorrFront();
   double AutocorrBack();
+  double BinError(int level);
+  double BinnedError(int min_bins = 100);
+  double BinnedAutocorrTime(int min_bins = 100);
+  std::vector<double> LastMeasurements() const;
 
-  double sum;  // sum of measurements
-  double sum2;  // sum of squared measurements
+  double mean;  // running mean of measurements
+  double m2;  // running sum of squared deviations from the mean
   double last;  // most recent measurement
   int n;  // number of measurements
   std::vector<double> first_1000;  // first 1000 measurements
-  std::deque<double> last_1000;  // last 1000 measurements
+  std::vector<double> last_1000;  // last 1000 measurements (ring buffer)
+  int last_pos;  // position of the oldest of the last 1000 measurements
+
+  // logarithmic binning: level l holds blocks of 2^l measurements. the memory
+  // is proportional to log(n), and the error at large block sizes accounts
+  // for autocorrelations.
+  // ref: H. Flyvbjerg and H. G. Petersen, J. Chem. Phys. 91, 461 (1989).
+  std::vector<double> bin_mean;  // running mean of block means
+  std::vector<double> bin_m2;  // running sum of squared deviations
+  std::vector<double> bin_last;  // most recent block mean
+  std::vector<int> bin_n;  // number of complete blocks
 };
 
 QfeMeasReal::QfeMeasReal() {
   Reset();
 }
 
+// the binning levels are written after the mean, error and count on the same
+// line so that the first three columns are the same as before
+
 void QfeMeasReal::WriteMeasurement(FILE* file) {
-  fprintf(file, "%.16e %.16e %d\n", Mean(), Error(), n);
+  fprintf(file, "%.16e %.16e %d", Mean(), Error(), n);
+  fprintf(file, " %d", int(bin_n.size()));
+  for (int l = 0; l < bin_n.size(); l++) {
+    fprintf(file, " %.16e %.16e %.16e %d", bin_mean[l], bin_m2[l],
+            bin_last[l], bin_n[l]);
+  }
+  fprintf(file, "\n");
 }
 
 void QfeMeasReal::ReadMeasurement(FILE* file) {
   Reset();
-  double mean;
   double err;
-  fscanf(file, "%lf %lf %d\n", &mean, &err, &n);
-  double count = double(n);
-  sum = mean * count;
-  sum2 = (err * err * count + mean * mean) * count;
+  fscanf(file, "%lf %lf %d", &mean, &err, &n);
+  m2 = err * err * double(n) * double(n);
+
+  // files written without the binning levels end here
+  int c = fgetc(file);
+  while (c == ' ' || c == '\t') c = fgetc(file);
+  if (c != EOF) ungetc(c, file);
+  if (c != EOF && c != '\n' && c != '\r') {
+    int n_levels = 0;
+    fscanf(file, "%d", &n_levels);
+    bin_mean.resize(n_levels);
+    bin_m2.resize(n_levels);
+    bin_last.resize(n_levels);
+    bin_n.resize(n_levels);
+    for (int l = 0; l < n_levels; l++) {
+      fscanf(file, "%lf %lf %lf %d", &bin_mean[l], &bin_m2[l], &bin_last[l],
+             &bin_n[l]);
+    }
+    if (n_levels) {
+      mean = bin_mean[0];
+      m2 = bin_m2[0];
+    }
+  }
+  fscanf(file, "\n");
 }
 
 void QfeMeasReal::Reset() {
-  sum = 0.0;
-  sum2 = 0.0;
+  mean = 0.0;
+  m2 = 0.0;
   last = 0.0;
   n = 0;
   first_1000.clear();
   last_1000.clear();
+  last_pos = 0;
+  bin_mean.clear();
+  bin_m2.clear();
+  bin_last.clear();
+  bin_n.clear();
 }
 
 void QfeMeasReal::Measure(double value, bool calc_autocorr) {
-  sum += value;
-  sum2 += value * value;
+  WelfordAdd(value, mean, m2, n);
   last = value;
-  n++;
 
   if (calc_autocorr) {
     if (first_1000.size() < 1000) first_1000.push_back(value);
-    last_1000.push_back(value);
-    if (last_1000.size() > 1000) last_1000.pop_front();
+    if (last_1000.size() < 1000) {
+      last_1000.push_back(value);
+    } else {
+      last_1000[last_pos] = value;
+      last_pos = (last_pos + 1) % 1000;
+    }
+  }
+
+  // add the value to level 0. every second block at a level completes a block
+  // at the next level.
+  for (int l = 0; true; l++) {
+    if (l == bin_n.size()) {
+      bin_mean.push_back(0.0);
+      bin_m2.push_back(0.0);
+      bin_last.push_back(0.0);
+      bin_n.push_back(0);
+    }
+    WelfordAdd(value, bin_mean[l], bin_m2[l], bin_n[l]);
+    if (bin_n[l] & 1) {
+      bin_last[l] = value;
+      break;
+    }
+    value = 0.5 * (bin_last[l] + value);
   }
 }
 
+// combine with the measurements of another object, as if they were measured
+// after the measurements of this object. this can be used to combine
+// measurements from several threads, replicas or seeds without a lock. the
+// result does not depend on the number of threads if the objects are always
+// merged in the same order. at each binning level, an incomplete block from
+// each object is paired into a block of the next level.
+
+void QfeMeasReal::Merge(const QfeMeasReal& other) {
+  if (other.n == 0) return;
+
+  // the last 1000 measurements of the combined series
+  std::vector<double> last_a = LastMeasurements();
+  std::vector<double> last_b = other.LastMeasurements();
+  last_a.insert(last_a.end(), last_b.begin(), last_b.end());
+  if (last_a.size() > 1000) last_a.erase(last_a.begin(), last_a.end() - 1000);
+  last_1000 = last_a;
+  last_pos = 0;
+  for (int i = 0; i < other.first_1000.size(); i++) {
+    if (first_1000.size() == 1000) break;
+    first_1000.push_back(other.first_1000[i]);
+  }
+
+  // merge the binning levels from the bottom up. the incomplete blocks at
+  // each level (from either object, or carried from the level below) are
+  // paired into a block that is carried to the next level.
+  bool has_carry = false;
+  double carry = 0.0;
+  for (int l = 0; l < other.bin_n.size() || has_carry; l++) {
+    if (l == bin_n.size()) {
+      bin_mean.push_back(0.0);
+      bin_m2.push_back(0.0);
+      bin_last.push_back(0.0);
+      bin_n.push_back(0);
+    }
+    double pending[3];
+    int n_pending = 0;
+    if (bin_n[l] & 1) pending[n_pending++] = bin_last[l];
+    if (l < other.bin_n.size()) {
+      if (other.bin_n[l] & 1) pending[n_pending++] = other.bin_last[l];
+      WelfordMerge(other.bin_mean[l], other.bin_m2[l], other.bin_n[l],
+                   bin_mean[l], bin_m2[l], bin_n[l]);
+    }
+    if (has_carry) {
+      pending[n_pending++] = carry;
+      WelfordAdd(carry, bin_mean[l], bin_m2[l], bin_n[l]);
+    }
+
+    has_carry = n_pending >= 2;
+    if (has_carry) carry = 0.5 * (pending[0] + pending[1]);
+    if (n_pending & 1) bin_last[l] = pending[n_pending - 1];
+  }
+
+  WelfordMerge(other.mean, other.m2, other.n, mean, m2, n);
+  last = other.last;
+}
+
 double QfeMeasReal::Mean() {
-  if (n == 0) return 0.0;
-  return sum / double(n);
+  return mean;
+}
+
+// sum of the measurements and of their squares, recovered from the running
+// mean and sum of squared deviations (for writing the raw sums to data files)
+double QfeMeasReal::Sum() {
+  return mean * double(n);
+}
+
+double QfeMeasReal::Sum2() {
+  return m2 + mean * mean * double(n);
 }
 
 double QfeMeasReal::Error() {
   if (n == 0) return 0.0;
-  double mean = sum / double(n);
-  double mean2 = sum2 / double(n);
-  return sqrt((mean2 - mean * mean) / double(n));
+  return sqrt(m2 / double(n)) / sqrt(double(n));
 }
 
 double QfeMeasReal::AutocorrFront() {
@@ -91,21 +267,59 @@ double QfeMeasReal::AutocorrFront() {
 
 double QfeMeasReal::AutocorrBack() {
   if (n == 0) return 0.0;
-  // convert last_1000 to a vector
-  std::deque<double>::iterator it = last_1000.begin();
-  std::vector<double> a;
-  while (it != last_1000.end()) {
-    a.push_back(*it++);
-  }
+  std::vector<double> a = LastMeasurements();
   return AutocorrTime(a);
 }
 
+// error of the mean estimated from the blocks at a single binning level
+
+double QfeMeasReal::BinError(int level) {
+  if (level >= bin_n.size() || bin_n[level] < 2) return 0.0;
+  double count = double(bin_n[level]);
+  return sqrt(bin_m2[level] / (count - 1.0) / count);
+}
+
+// error of the mean for correlated measurements, from the largest blocks with
+// at least min_bins blocks. the blocks should be much longer than the
+// autocorrelation time, but with fewer blocks the error estimate itself has a
+// relative error of about sqrt(2 / min_bins). if the binning levels do not
+// include every measurement (e.g. after reading an old file), the naive error
+// is returned instead.
+
+double QfeMeasReal::BinnedError(int min_bins) {
+  if (bin_n.empty() || bin_n[0] != n) return Error();
+  int level = 0;
+  while (level + 1 < bin_n.size() && bin_n[level + 1] >= min_bins) level++;
+  return BinError(level);
+}
+
+// integrated autocorrelation time from the ratio of the binned error to the
+// error of uncorrelated measurements
+
+double QfeMeasReal::BinnedAutocorrTime(int min_bins) {
+  if (bin_n.empty() || bin_n[0] != n) return 0.5;
+  double err0 = BinError(0);
+  if (err0 == 0.0) return 0.5;
+  double ratio = BinnedError(min_bins) / err0;
+  return 0.5 * ratio * ratio;
+}
+
+// the last 1000 measurements in order (oldest first)
+
+std::vector<double> QfeMeasReal::LastMeasurements() const {
+  std::vector<double> a(last_1000.size());
+  std::rotate_copy(last_1000.begin(), last_1000.begin() + last_pos,
+                   last_1000.end(), a.begin());
+  return a;
+}
+
 class QfeMeasComplex {
 
 public:
   QfeMeasComplex();
   void Reset();
   void Measure(Complex value, bool calc_autocorr = true);
+  void Merge(const QfeMeasComplex& other);
   Complex Mean();
   Complex Error();
   double AutocorrFront();
@@ -132,6 +346,13 @@ void QfeMeasComplex::Measure(Complex value, bool calc_autocorr) {
   last = value;
 }
 
+void QfeMeasComplex::Merge(const QfeMeasComplex& other) {
+  if (other.real_part.n == 0) return;
+  real_part.Merge(other.real_part);
+  imag_part.Merge(other.imag_part);
+  last = other.last;
+}
+
 Complex QfeMeasComplex::Mean() {
   return Complex(real_part.Mean(), imag_part.Mean());
 }
@@ -177,90 +398,184 @@ double Susceptibility(std::vector<double>& m2, std::vector<double>& m) {
   return m2_mean - m_mean * m_mean;
 }
 
-double JackknifeMean(std::vector<double>& a) {
-  int n = a.size();
-	double mean = Mean(a);
-	double err = 0.0;
+// resampling of several observable series that are measured on the same
+// configurations. the series are split into n_blocks contiguous blocks and
+// the sum of each block is computed once, so each jackknife or bootstrap
+// sample only costs O(n_blocks) plus the cost of f, no matter how long the
+// series are. f is called with the (resampled) mean of each observable, in
+// the same order as the series, and can be any derived quantity, e.g.
+// [](const std::vector<double>& m) { return m[1] / (m[0] * m[0]); }.
+// samples are computed in parallel, and the bootstrap samples use a counter
+// based generator, so the results do not depend on the number of threads.
 
-	for (int i = 0; i < n; i++) {
-    std::vector<double> a_del = a;
-    a_del.erase(a_del.begin() + i);
-    double diff = Mean(a_del) - mean;
-    err += diff * diff;
-  }
+class QfeResample {
 
-	err = sqrt((double(n) - 1.0) / double(n) * err);
-	return err;
-}
+public:
+  QfeResample(const std::vector<const std::vector<double>*>& a,
+              int n_blocks = 0);
+  std::vector<double> SampleMeans(const std::vector<double>& weight);
+  template <typename F>
+  double Jackknife(F f, double& err, int n_threads = 0);
+  template <typename F>
+  double Bootstrap(F f, double& err, int n_samples = 1000,
+                   uint64_t seed = 12345678, int n_threads = 0);
 
-double JackknifeLogMean(std::vector<double>& a) {
-  int n = a.size();
-  std::vector<double> bin_means(n);
+  int n_obs;  // number of observables
+  int n_blocks;  // number of blocks
+  std::vector<double> total;  // sum of each observable
+  std::vector<double> block_sum;  // sum of each observable in each block
+  std::vector<int> block_count;  // number of samples in each block
+  std::vector<double> samples;  // estimates from the last resampling
+};
+
+// split the series into n_blocks blocks (n_blocks = 0 for one sample per block)
+
+QfeResample::QfeResample(const std::vector<const std::vector<double>*>& a,
+                         int n_blocks) {
+  n_obs = a.size();
+  int n = a[0]->size();
+  if (n_blocks <= 0 || n_blocks > n) n_blocks = n;
+  this->n_blocks = n_blocks;
 
+  total.resize(n_obs, 0.0);
+  block_sum.resize(long(n_blocks) * n_obs, 0.0);
+  block_count.resize(n_blocks, 0);
   for (int i = 0; i < n; i++) {
-    std::vector<double> a_del = a;
-    a_del.erase(a_del.begin() + i);
-    bin_means[i] = LogMean(a_del);
+    int b = int((long(i) * n_blocks) / n);
+    block_count[b]++;
+    for (int j = 0; j < n_obs; j++) {
+      block_sum[long(b) * n_obs + j] += (*a[j])[i];
+    }
   }
+  for (int b = 0; b < n_blocks; b++) {
+    for (int j = 0; j < n_obs; j++) total[j] += block_sum[long(b) * n_obs + j];
+  }
+}
 
-  double mean = Mean(bin_means);
-	double err = 0.0;
+// means of a sample that includes each block weight[b] times
 
-	for (int i = 0; i < n; i++) {
-    double diff = bin_means[i] - mean;
-    err += diff * diff;
+std::vector<double> QfeResample::SampleMeans(
+    const std::vector<double>& weight) {
+  std::vector<double> means(n_obs, 0.0);
+  double count = 0.0;
+  for (int b = 0; b < n_blocks; b++) {
+    if (weight[b] == 0.0) continue;
+    count += weight[b] * block_count[b];
+    for (int j = 0; j < n_obs; j++) {
+      means[j] += weight[b] * block_sum[long(b) * n_obs + j];
+    }
   }
-
-	err = sqrt((double(n) - 1.0) / double(n) * err);
-	return err;
+  for (int j = 0; j < n_obs; j++) means[j] /= count;
+  return means;
 }
 
-double JackknifeU4(std::vector<double>& m2, std::vector<double>& m4) {
-  int n = m2.size();
-	std::vector<double> bin_means(n);
+// blocked jackknife. returns f of the full means, and err is the jackknife
+// error. the estimate with each block deleted is stored in samples.
 
-  for (int i = 0; i < n; i++) {
-    std::vector<double> m2_del = m2;
-    std::vector<double> m4_del = m4;
-    m2_del.erase(m2_del.begin() + i);
-    m4_del.erase(m4_del.begin() + i);
-    bin_means[i] = U4(m2_del, m4_del);
-  }
+template <typename F>
+double QfeResample::Jackknife(F f, double& err, int n_threads) {
+  std::vector<double> means(n_obs);
+  double n = 0.0;
+  for (int b = 0; b < n_blocks; b++) n += block_count[b];
+  for (int j = 0; j < n_obs; j++) means[j] = total[j] / n;
+  double est = f(means);
 
-  double mean = Mean(bin_means);
-	double err = 0.0;
+  err = 0.0;
+  samples.resize(n_blocks);
+  if (n_blocks < 2) return est;
+  ParallelFor(n_blocks, n_threads, [&](int b_begin, int b_end, int t) {
+    std::vector<double> del_means(n_obs);
+    for (int b = b_begin; b < b_end; b++) {
+      double count = n - block_count[b];
+      for (int j = 0; j < n_obs; j++) {
+        del_means[j] = (total[j] - block_sum[long(b) * n_obs + j]) / count;
+      }
+      samples[b] = f(del_means);
+    }
+  });
 
-	for (int i = 0; i < n; i++) {
-    double diff = bin_means[i] - mean;
+  double mean = Mean(samples);
+  for (int b = 0; b < n_blocks; b++) {
+    double diff = samples[b] - mean;
     err += diff * diff;
   }
-
-	err = sqrt((double(n) - 1.0) / double(n) * err);
-	return err;
+  err = sqrt((double(n_blocks) - 1.0) / double(n_blocks) * err);
+  return est;
 }
 
-double JackknifeSusceptibility(std::vector<double>& m2, std::vector<double>& m) {
-  int n = m2.size();
-  std::vector<double> bin_means(n);
+// blocked bootstrap. each sample draws n_blocks blocks with replacement.
+// returns f of the full means, and err is the standard deviation of the
+// bootstrap estimates, which are stored in samples.
 
-  for (int i = 0; i < n; i++) {
-    std::vector<double> m2_del = m2;
-    std::vector<double> m_del = m;
-    m2_del.erase(m2_del.begin() + i);
-    m_del.erase(m_del.begin() + i);
-    bin_means[i] = Susceptibility(m2_del, m_del);
-  }
+template <typename F>
+double QfeResample::Bootstrap(F f, double& err, int n_samples, uint64_t seed,
+                              int n_threads) {
+  std::vector<double> weight(n_blocks, 1.0);
+  double est = f(SampleMeans(weight));
 
-	double mean = Mean(bin_means);
-	double err = 0.0;
+  err = 0.0;
+  samples.resize(n_samples);
+  if (n_samples < 2) return est;
+  QfeCounterRng crng(seed);
+  ParallelFor(n_samples, n_threads, [&](int i_begin, int i_end, int t) {
+    std::vector<double> w(n_blocks);
+    for (int i = i_begin; i < i_end; i++) {
+      QfeRngStream rng(crng, 0, i);
+      std::fill(w.begin(), w.end(), 0.0);
+      for (int b = 0; b < n_blocks; b++) {
+        w[rng.RandInt(0, n_blocks - 1)] += 1.0;
+      }
+      samples[i] = f(SampleMeans(w));
+    }
+  });
 
-	for (int i = 0; i < n; i++) {
-    double diff = bin_means[i] - mean;
+  double mean = Mean(samples);
+  for (int i = 0; i < n_samples; i++) {
+    double diff = samples[i] - mean;
     err += diff * diff;
   }
+  err = sqrt(err / (double(n_samples) - 1.0));
+  return est;
+}
+
+// blocked jackknife error of f(means), where the samples of each observable
+// are split into n_bins contiguous bins (n_bins = 0 deletes one sample at a
+// time). see QfeResample.
+
+template <typename F>
+double Jackknife(const std::vector<const std::vector<double>*>& a, F f,
+                 int n_bins = 0) {
+  QfeResample resample(a, n_bins);
+  double err;
+  resample.Jackknife(f, err, 1);
+  return err;
+}
+
+double JackknifeMean(std::vector<double>& a, int n_bins = 0) {
+  return Jackknife(
+      {&a}, [](const std::vector<double>& m) { return m[0]; }, n_bins);
+}
+
+double JackknifeLogMean(std::vector<double>& a, int n_bins = 0) {
+  return Jackknife(
+      {&a}, [](const std::vector<double>& m) { return log(m[0]); }, n_bins);
+}
 
-	err = sqrt((double(n) - 1.0) / double(n) * err);
-	return err;
+double JackknifeU4(std::vector<double>& m2, std::vector<double>& m4,
+                   int n_bins = 0) {
+  return Jackknife(
+      {&m2, &m4},
+      [](const std::vector<double>& m) {
+        return 1.5 * (1.0 - m[1] / (3.0 * m[0] * m[0]));
+      },
+      n_bins);
+}
+
+double JackknifeSusceptibility(std::vector<double>& m2, std::vector<double>& m,
+                               int n_bins = 0) {
+  return Jackknife(
+      {&m2, &m},
+      [](const std::vector<double>& x) { return x[0] - x[1] * x[1]; }, n_bins);
 }
 
 double AutocorrGamma(std::vector<double>& a, int n) {
@@ -282,15 +597,847 @@ double AutocorrGamma(std::vector<double>& a, int n) {
   return result / double(end - start);
 }
 
+// in-place radix-2 fast fourier transform (the size must be a power of 2).
+// the inverse transform is not normalized.
+
+void FFT(std::vector<Complex>& a, bool inverse = false) {
+  int n = a.size();
+  assert((n & (n - 1)) == 0);
+
+  // bit reversal permutation
+  for (int i = 1, j = 0; i < n; i++) {
+    int bit = n >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i < j) std::swap(a[i], a[j]);
+  }
+
+  for (int len = 2; len <= n; len <<= 1) {
+    double angle = 2.0 * M_PI / len * (inverse ? 1.0 : -1.0);
+    Complex w_len(cos(angle), sin(angle));
+    for (int i = 0; i < n; i += len) {
+      Complex w = 1.0;
+      for (int j = 0; j < len / 2; j++) {
+        Complex u = a[i + j];
+        Complex v = a[i + j + len / 2] * w;
+        a[i + j] = u + v;
+        a[i + j + len / 2] = u - v;
+        w *= w_len;
+      }
+    }
+  }
+}
+
+// autocorrelation function Gamma(n) for all lags n = 0 to N - 1, computed with
+// an fft in O(N log N). Gamma(n) is the same as AutocorrGamma(a, n).
+
+std::vector<double> AutocorrFunction(const std::vector<double>& a) {
+  int N = a.size();
+  if (N == 0) return std::vector<double>();
+  double mean = 0.0;
+  for (int i = 0; i < N; i++) mean += a[i];
+  mean /= N;
+
+  // zero pad to at least 2N to avoid wrapping around
+  int n_fft = 1;
+  while (n_fft < 2 * N) n_fft <<= 1;
+  std::vector<Complex> f(n_fft, 0.0);
+  for (int i = 0; i < N; i++) f[i] = a[i] - mean;
+
+  FFT(f);
+  for (int i = 0; i < n_fft; i++) f[i] = std::norm(f[i]);
+  FFT(f, true);
+
+  std::vector<double> gamma(N);
+  for (int n = 0; n < N; n++) {
+    gamma[n] = real(f[n]) / (double(n_fft) * double(N - n));
+  }
+  return gamma;
+}
+
 double AutocorrTime(std::vector<double>& a) {
-  double Gamma0 = AutocorrGamma(a, 0);
-  double result = 0.5 * Gamma0;
+  if (a.size() < 2) return 0.0;
+  std::vector<double> gamma = AutocorrFunction(a);
+  double result = 0.5 * gamma[0];
 
   for (int n = 1; n < a.size(); n++) {
-    double curGamma = AutocorrGamma(a, n);
-    if (curGamma < 0.0) break;
-    result += curGamma;
+    if (gamma[n] < 0.0) break;
+    result += gamma[n];
+  }
+
+  return result / gamma[0];
+}
+
+// integrated autocorrelation time with automatic windowing. the sum over lags
+// is cut off at the first window W where g(W) = exp(-W / tau) -
+// tau / sqrt(W N) becomes negative, with tau = S / log((2 tau_int + 1) /
+// (2 tau_int - 1)). S ~ 1 - 2 is a safety factor for slowly decaying modes.
+// err is the statistical error of tau_int, and window is set to W.
+// ref: U. Wolff, Comput. Phys. Commun. 156, 143 (2004).
+// ref: N. Madras and A. D. Sokal, J. Stat. Phys. 50, 109 (1988).
+
+double AutocorrTimeWindowed(const std::vector<double>& a, double& err,
+                            int& window, double S = 1.5) {
+  int N = a.size();
+  err = 0.0;
+  window = 0;
+  if (N < 2) return 0.5;
+  std::vector<double> gamma = AutocorrFunction(a);
+  if (gamma[0] <= 0.0) return 0.5;
+
+  double tau_int = 0.5;
+  for (int W = 1; W < N; W++) {
+    tau_int += gamma[W] / gamma[0];
+    window = W;
+    double tau = 1.0e-10;
+    if (tau_int > 0.5) {
+      tau = S / log((2.0 * tau_int + 1.0) / (2.0 * tau_int - 1.0));
+    }
+    double g = exp(-W / tau) - tau / sqrt(double(W) * N);
+    if (g < 0.0) break;
+  }
+
+  err = tau_int * sqrt((4.0 * window + 2.0) / N);
+  return tau_int;
+}
+
+double AutocorrTimeWindowed(const std::vector<double>& a, double& err) {
+  int window;
+  return AutocorrTimeWindowed(a, err, window);
+}
+
+// multi-histogram reweighting of several runs at different values of a
+// coupling c, where each configuration has weight exp(-c * E). for the ising
+// model c = beta and E = vol * Action() / beta, and for phi4 c = msq and
+// E = 0.5 * sum(wt * phi^2). the relative partition functions solve the wham
+// equations, which are the stationarity conditions of a convex function of
+// log Z. they are found with newton's method and a backtracking line search,
+// working in log space, which avoids overflow when the runs are far apart.
+// errors are estimated with a blocked jackknife, where jackknife sample b
+// removes block b from every run. each jackknife sample starts from the full
+// solution, so it only needs a few newton steps.
+// ref: A. M. Ferrenberg and R. H. Swendsen, Phys. Rev. Lett. 63, 1195 (1989).
+// M. R. Shirts and J. D. Chodera, J. Chem. Phys. 129, 124105 (2008).
+
+// largest newton step (in log Z) taken by QfeReweight::Solve
+#define QFE_WHAM_MAX_NEWTON_STEP 1.0
+
+class QfeReweight {
+
+public:
+  QfeReweight();
+  int AddRun(double coupling, const std::vector<double>& energy,
+             const std::vector<std::vector<double>>& obs);
+  int Solve(int n_blocks = 20, double tol = 1.0e-10, int max_iter = 100);
+  std::vector<double> Means(double coupling, int sample = -1);
+  template <typename F>
+  double Estimate(double coupling, F f, double& err);
+  double Mean(double coupling, int i_obs, double& err);
+  double U4(double coupling, int i_m2, int i_m4, double& err);
+  double Susceptibility(double coupling, int i_m2, int i_m, double& err);
+
+  int n_runs;
+  int n_obs;  // number of observables per configuration
+  int n_blocks;  // number of jackknife blocks
+  int n_unconverged;  // samples that did not converge in the last Solve
+  std::vector<double> run_coupling;  // coupling of each run
+  std::vector<int> run_offset;  // first configuration of each run
+  std::vector<double> energy;  // energy of each configuration
+  std::vector<double> obs;  // observables of each configuration (n_obs each)
+  std::vector<int> block;  // jackknife block of each configuration
+
+  // log partition function of each run (indexed by sample, then run) and the
+  // log denominator of each configuration (indexed by sample, then config).
+  // sample 0 uses all configurations and sample b + 1 removes block b.
+  std::vector<std::vector<double>> log_z;
+  std::vector<std::vector<double>> log_den;
+
+private:
+  int SolveSample(int sample, double tol, int max_iter);
+  double SampleDen(int sample, const std::vector<double>& log_n,
+                   const std::vector<double>& lz);
+  void SampleLogZ(int sample, std::vector<double>& lz);
+};
+
+QfeReweight::QfeReweight() {
+  n_runs = 0;
+  n_obs = 0;
+  n_blocks = 0;
+  n_unconverged = 0;
+  run_offset.push_back(0);
+}
+
+// add a run at a given coupling. energy[n] is the energy of configuration n
+// and obs[i][n] is observable i of configuration n. every run must have the
+// same number of observables. returns the run index.
+
+int QfeReweight::AddRun(double coupling, const std::vector<double>& energy,
+                        const std::vector<std::vector<double>>& obs) {
+  int n_conf = energy.size();
+  if (n_runs == 0) n_obs = obs.size();
+  assert(obs.size() == n_obs);
+  for (int i = 0; i < n_obs; i++) assert(obs[i].size() == n_conf);
+
+  run_coupling.push_back(coupling);
+  for (int n = 0; n < n_conf; n++) {
+    this->energy.push_back(energy[n]);
+    for (int i = 0; i < n_obs; i++) this->obs.push_back(obs[i][n]);
+  }
+  run_offset.push_back(run_offset.back() + n_conf);
+  return n_runs++;
+}
+
+// solve the wham equations for the full data set and for each jackknife
+// sample. returns the number of newton steps for the full data set. samples
+// that don't converge in max_iter steps are counted in n_unconverged and
+// reported on stderr.
+
+int QfeReweight::Solve(int n_blocks, double tol, int max_iter) {
+  assert(n_runs > 0);
+  this->n_blocks = n_blocks;
+  int n_total = energy.size();
+
+  block.resize(n_total);
+  for (int k = 0; k < n_runs; k++) {
+    int n_conf = run_offset[k + 1] - run_offset[k];
+    for (int n = 0; n < n_conf; n++) {
+      block[run_offset[k] + n] = n_blocks ? (long(n) * n_blocks) / n_conf : 0;
+    }
+  }
+
+  log_z.assign(n_blocks + 1, std::vector<double>(n_runs, 0.0));
+  log_den.assign(n_blocks + 1, std::vector<double>(n_total, 0.0));
+  n_unconverged = 0;
+  int n_iter = SolveSample(0, tol, max_iter);
+
+  // start each jackknife sample from the full solution
+  for (int b = 0; b < n_blocks; b++) {
+    log_z[b + 1] = log_z[0];
+    SolveSample(b + 1, tol, max_iter);
+  }
+
+  if (n_unconverged) {
+    fprintf(stderr, "wham: %d of %d samples did not converge\n",
+            n_unconverged, n_blocks + 1);
+  }
+  return n_iter;
+}
+
+// log denominator of each configuration in a sample,
+// log_den_n = log sum_k N_k exp(-c_k E_n - log Z_k). returns the wham
+// objective sum_n log_den_n + sum_k N_k log Z_k, which is convex in log Z and
+// is minimized by the solution of the wham equations.
+
+double QfeReweight::SampleDen(int sample, const std::vector<double>& log_n,
+                              const std::vector<double>& lz) {
+  int n_total = energy.size();
+  int skip = sample - 1;  // block to skip (-1 for none)
+  std::vector<double>& ld = log_den[sample];
+  std::vector<double> term(n_runs);
+
+  double objective = 0.0;
+  for (int k = 0; k < n_runs; k++) {
+    if (log_n[k] != -INFINITY) objective += exp(log_n[k]) * lz[k];
+  }
+  for (int n = 0; n < n_total; n++) {
+    if (block[n] == skip) continue;
+    double term_max = -INFINITY;
+    for (int k = 0; k < n_runs; k++) {
+      term[k] = log_n[k] - run_coupling[k] * energy[n] - lz[k];
+      term_max = std::max(term_max, term[k]);
+    }
+    double sum = 0.0;
+    for (int k = 0; k < n_runs; k++) sum += exp(term[k] - term_max);
+    ld[n] = term_max + log(sum);
+    objective += ld[n];
+  }
+  return objective;
+}
+
+// log Z_k = log sum_n exp(-c_k E_n - log_den_n) for the current denominators
+// of a sample (one step of the self-consistent iteration)
+
+void QfeReweight::SampleLogZ(int sample, std::vector<double>& lz) {
+  int n_total = energy.size();
+  int skip = sample - 1;  // block to skip (-1 for none)
+  const std::vector<double>& ld = log_den[sample];
+  for (int k = 0; k < n_runs; k++) {
+    double term_max = -INFINITY;
+    for (int n = 0; n < n_total; n++) {
+      if (block[n] == skip) continue;
+      term_max = std::max(term_max, -run_coupling[k] * energy[n] - ld[n]);
+    }
+    double sum = 0.0;
+    for (int n = 0; n < n_total; n++) {
+      if (block[n] == skip) continue;
+      sum += exp(-run_coupling[k] * energy[n] - ld[n] - term_max);
+    }
+    lz[k] = term_max + log(sum);
+  }
+}
+
+int QfeReweight::SolveSample(int sample, double tol, int max_iter) {
+  int n_total = energy.size();
+  int skip = sample - 1;  // block to skip (-1 for none)
+  std::vector<double>& lz = log_z[sample];
+  std::vector<double>& ld = log_den[sample];
+
+  // log of the number of configurations in each run. runs with no
+  // configurations in this sample don't enter the equations, and log Z of the
+  // first remaining run is held fixed.
+  std::vector<double> log_n(n_runs);
+  std::vector<int> active;
+  for (int k = 0; k < n_runs; k++) {
+    int count = 0;
+    for (int n = run_offset[k]; n < run_offset[k + 1]; n++) {
+      if (block[n] != skip) count++;
+    }
+    log_n[k] = count ? log(double(count)) : -INFINITY;
+    if (count) active.push_back(k);
+  }
+  int ref = active.size() ? active[0] : 0;
+  if (active.size()) active.erase(active.begin());
+  int n_act = active.size();
+
+  // the gradient of the objective with respect to log Z_k is N_k - s_k, where
+  // s_k = sum_n w_nk and w_nk = N_k exp(-c_k E_n - log Z_k - log_den_n) is the
+  // fraction of configuration n assigned to run k. the hessian is
+  // H_kl = s_k delta_kl - sum_n w_nk w_nl.
+  std::vector<double> w(n_act);
+  std::vector<double> grad(n_act);
+  std::vector<double> hess(n_act * n_act);
+  std::vector<double> step(n_act);
+  std::vector<double> lz_try(n_runs);
+  double objective = SampleDen(sample, log_n, lz);
+  bool converged = (n_act == 0);
+  int iter = 0;
+  while (!converged && iter < max_iter) {
+    iter++;
+    std::fill(grad.begin(), grad.end(), 0.0);
+    std::fill(hess.begin(), hess.end(), 0.0);
+    for (int n = 0; n < n_total; n++) {
+      if (block[n] == skip) continue;
+      for (int a = 0; a < n_act; a++) {
+        int k = active[a];
+        w[a] = exp(log_n[k] - run_coupling[k] * energy[n] - lz[k] - ld[n]);
+        grad[a] -= w[a];
+        hess[a * n_act + a] += w[a];
+      }
+      for (int a = 0; a < n_act; a++) {
+        for (int b = 0; b <= a; b++) hess[a * n_act + b] -= w[a] * w[b];
+      }
+    }
+    for (int a = 0; a < n_act; a++) grad[a] += exp(log_n[active[a]]);
+
+    // newton step from the cholesky factorization of the hessian (lower
+    // triangle). far from the solution (or if the hessian isn't positive
+    // definite, e.g. for runs that don't overlap) the newton step can be
+    // huge, so a step of the self-consistent iteration is taken instead.
+    bool newton = true;
+    for (int a = 0; a < n_act && newton; a++) {
+      for (int b = 0; b <= a; b++) {
+        double sum = hess[a * n_act + b];
+        for (int j = 0; j < b; j++) {
+          sum -= hess[a * n_act + j] * hess[b * n_act + j];
+        }
+        if (a == b) {
+          if (!(sum > 0.0)) {
+            newton = false;
+            break;
+          }
+          hess[a * n_act + a] = sqrt(sum);
+        } else {
+          hess[a * n_act + b] = sum / hess[b * n_act + b];
+        }
+      }
+    }
+    double step_max = 0.0;
+    if (newton) {
+      for (int a = 0; a < n_act; a++) {
+        double sum = -grad[a];
+        for (int j = 0; j < a; j++) sum -= hess[a * n_act + j] * step[j];
+        step[a] = sum / hess[a * n_act + a];
+      }
+      for (int a = n_act - 1; a >= 0; a--) {
+        double sum = step[a];
+        for (int j = a + 1; j < n_act; j++) {
+          sum -= hess[j * n_act + a] * step[j];
+        }
+        step[a] = sum / hess[a * n_act + a];
+        step_max = std::max(step_max, fabs(step[a]));
+      }
+    }
+    if (!newton || !(step_max <= QFE_WHAM_MAX_NEWTON_STEP)) {
+      SampleLogZ(sample, lz_try);
+      step_max = 0.0;
+      for (int a = 0; a < n_act; a++) {
+        int k = active[a];
+        step[a] = (lz_try[k] - lz_try[ref]) - (lz[k] - lz[ref]);
+        step_max = std::max(step_max, fabs(step[a]));
+      }
+    }
+
+    // backtracking line search on the objective (a full step is almost
+    // always accepted). the solution has converged when the full step is
+    // below the tolerance.
+    double t = 1.0;
+    bool accepted = false;
+    for (int i = 0; i < 30 && !accepted; i++) {
+      lz_try = lz;
+      for (int a = 0; a < n_act; a++) lz_try[active[a]] += t * step[a];
+      double objective_try = SampleDen(sample, log_n, lz_try);
+      if (objective_try <= objective + 1.0e-12 * (1.0 + fabs(objective))) {
+        lz = lz_try;
+        objective = objective_try;
+        accepted = true;
+      }
+      t *= 0.5;
+    }
+    if (!accepted) {
+      SampleDen(sample, log_n, lz);
+      break;
+    }
+    converged = (step_max < tol);
+  }
+  if (!converged) n_unconverged++;
+
+  // log Z of the runs that aren't in this sample, and normalization to the
+  // first run
+  SampleLogZ(sample, lz_try);
+  for (int k = 0; k < n_runs; k++) {
+    if (log_n[k] == -INFINITY) lz[k] = lz_try[k] - lz_try[ref] + lz[ref];
+  }
+  double shift = lz[0];
+  for (int k = 0; k < n_runs; k++) lz[k] -= shift;
+  SampleDen(sample, log_n, lz);
+
+  return iter;
+}
+
+// reweighted mean of every observable at a coupling, using the full data set
+// (sample = -1) or jackknife sample b (sample = b)
+
+std::vector<double> QfeReweight::Means(double coupling, int sample) {
+  int n_total = energy.size();
+  int skip = sample;
+  const std::vector<double>& ld = log_den[sample + 1];
+
+  double log_w_max = -INFINITY;
+  for (int n = 0; n < n_total; n++) {
+    if (block[n] == skip) continue;
+    log_w_max = std::max(log_w_max, -coupling * energy[n] - ld[n]);
+  }
+
+  double w_sum = 0.0;
+  std::vector<double> means(n_obs, 0.0);
+  for (int n = 0; n < n_total; n++) {
+    if (block[n] == skip) continue;
+    double w = exp(-coupling * energy[n] - ld[n] - log_w_max);
+    w_sum += w;
+    const double* o = &obs[long(n) * n_obs];
+    for (int i = 0; i < n_obs; i++) means[i] += w * o[i];
+  }
+  for (int i = 0; i < n_obs; i++) means[i] /= w_sum;
+  return means;
+}
+
+// reweighted estimate of f(means) at a coupling, with a jackknife error
+
+template <typename F>
+double QfeReweight::Estimate(double coupling, F f, double& err) {
+  double est = f(Means(coupling));
+  err = 0.0;
+  if (n_blocks < 2) return est;
+
+  std::vector<double> jack(n_blocks);
+  double jack_mean = 0.0;
+  for (int b = 0; b < n_blocks; b++) {
+    jack[b] = f(Means(coupling, b));
+    jack_mean += jack[b];
+  }
+  jack_mean /= n_blocks;
+  for (int b = 0; b < n_blocks; b++) {
+    double diff = jack[b] - jack_mean;
+    err += diff * diff;
+  }
+  err = sqrt((double(n_blocks) - 1.0) / double(n_blocks) * err);
+  return est;
+}
+
+double QfeReweight::Mean(double coupling, int i_obs, double& err) {
+  return Estimate(
+      coupling, [&](const std::vector<double>& m) { return m[i_obs]; }, err);
+}
+
+double QfeReweight::U4(double coupling, int i_m2, int i_m4, double& err) {
+  return Estimate(
+      coupling,
+      [&](const std::vector<double>& m) {
+        return 1.5 * (1.0 - m[i_m4] / (3.0 * m[i_m2] * m[i_m2]));
+      },
+      err);
+}
+
+double QfeReweight::Susceptibility(double coupling, int i_m2, int i_m,
+                                   double& err) {
+  return Estimate(
+      coupling,
+      [&](const std::vector<double>& m) { return m[i_m2] - m[i_m] * m[i_m]; },
+      err);
+}
+
+// append-only binary log of measurements, with one column per observable. the
+// file starts with the magic string "QFELOG01", the length of a text header,
+// and the header, which has one line per item:
+//
+//   dtype f32|f64
+//   column <name>
+//   param <key> <value>
+//
+// the data follows in chunks. each chunk is a 32-bit row count followed by the
+// values of each column for those rows (column-major), in native byte order.
+// a truncated chunk at the end of the file (e.g. after a crash) is ignored by
+// the reader.
+
+#define QFE_MEAS_LOG_MAGIC "QFELOG01"
+
+class QfeMeasLog {
+
+public:
+  QfeMeasLog();
+  ~QfeMeasLog();
+  QfeMeasLog(const QfeMeasLog&) = delete;  // owns the file
+  QfeMeasLog& operator=(const QfeMeasLog&) = delete;
+  bool Open(const std::string& path, const std::vector<std::string>& names,
+            const std::map<std::string, std::string>& params =
+                std::map<std::string, std::string>(),
+            bool use_float = false, int chunk_rows = 4096);
+  void Write(const double* row);
+  void Write(const std::vector<double>& row);
+  void Flush();
+  void Close();
+
+  FILE* file;
+  int n_cols;
+  bool use_float;  // store values as 32-bit floats
+  int chunk_rows;  // rows per chunk
+  int n_buf;  // rows in the buffer
+  std::vector<double> buf;  // buffered rows (column-major)
+};
+
+QfeMeasLog::QfeMeasLog() {
+  file = nullptr;
+  n_cols = 0;
+  use_float = false;
+  chunk_rows = 4096;
+  n_buf = 0;
+}
+
+QfeMeasLog::~QfeMeasLog() {
+  Close();
+}
+
+// open a log for writing. if the file already exists with the same columns and
+// dtype, new rows are appended to it. returns false if the file can't be
+// opened or has different columns.
+
+bool QfeMeasLog::Open(const std::string& path,
+                      const std::vector<std::string>& names,
+                      const std::map<std::string, std::string>& params,
+                      bool use_float, int chunk_rows) {
+  Close();
+  this->n_cols = names.size();
+  this->use_float = use_float;
+  this->chunk_rows = chunk_rows;
+  n_buf = 0;
+  buf.resize(long(n_cols) * chunk_rows);
+
+  std::string header = use_float ? "dtype f32\n" : "dtype f64\n";
+  for (int i = 0; i < n_cols; i++) header += "column " + names[i] + "\n";
+  for (auto it = params.begin(); it != params.end(); it++) {
+    header += "param " + it->first + " " + it->second + "\n";
+  }
+
+  // append to an existing log if the columns match
+  file = fopen(path.c_str(), "rb+");
+  if (file != nullptr) {
+    // the header size is checked against the file size before it is read
+    long file_size = -1;
+    if (fseek(file, 0, SEEK_END) == 0) file_size = ftell(file);
+    rewind(file);
+    char magic[8];
+    uint32_t header_size = 0;
+    bool ok = fread(magic, 1, 8, file) == 8 &&
+              memcmp(magic, QFE_MEAS_LOG_MAGIC, 8) == 0 &&
+              fread(&header_size, sizeof(uint32_t), 1, file) == 1 &&
+              file_size >= 12 && header_size <= file_size - 12;
+    if (!ok) header_size = 0;
+    std::string old_header(header_size, '\0');
+    ok = ok && fread(&old_header[0], 1, header_size, file) == header_size;
+
+    // compare everything except the parameters
+    auto strip_params = [](const std::string& h) {
+      std::string result;
+      size_t pos = 0;
+      while (pos < h.size()) {
+        size_t end = h.find('\n', pos);
+        if (end == std::string::npos) end = h.size() - 1;
+        std::string line = h.substr(pos, end - pos + 1);
+        if (line.compare(0, 6, "param ") != 0) result += line;
+        pos = end + 1;
+      }
+      return result;
+    };
+    if (!ok || strip_params(old_header) != strip_params(header)) {
+      fprintf(stderr, "incompatible measurement log: %s\n", path.c_str());
+      fclose(file);
+      file = nullptr;
+      return false;
+    }
+
+    // drop a truncated chunk at the end of the file
+    size_t value_size = use_float ? sizeof(float) : sizeof(double);
+    long offset = 12 + header_size;
+    uint32_t n_rows;
+    while (fseek(file, offset, SEEK_SET) == 0 &&
+           fread(&n_rows, sizeof(uint32_t), 1, file) == 1) {
+      long chunk_end =
+          offset + sizeof(uint32_t) + size_t(n_rows) * n_cols * value_size;
+      if (fseek(file, 0, SEEK_END) != 0 || ftell(file) < chunk_end) break;
+      offset = chunk_end;
+    }
+    fflush(file);
+    if (ftruncate(fileno(file), offset) != 0) {
+      fclose(file);
+      file = nullptr;
+      return false;
+    }
+    fseek(file, offset, SEEK_SET);
+    return true;
+  }
+
+  file = fopen(path.c_str(), "wb");
+  if (file == nullptr) return false;
+  uint32_t header_size = header.size();
+  fwrite(QFE_MEAS_LOG_MAGIC, 1, 8, file);
+  fwrite(&header_size, sizeof(uint32_t), 1, file);
+  fwrite(header.data(), 1, header_size, file);
+  return true;
+}
+
+// add a row with one value per column. rows are buffered and written a chunk
+// at a time. rows are dropped if the log isn't open.
+
+void QfeMeasLog::Write(const double* row) {
+  if (file == nullptr) return;
+  for (int i = 0; i < n_cols; i++) {
+    buf[long(i) * chunk_rows + n_buf] = row[i];
+  }
+  n_buf++;
+  if (n_buf == chunk_rows) Flush();
+}
+
+void QfeMeasLog::Write(const std::vector<double>& row) {
+  assert(row.size() == n_cols);
+  Write(row.data());
+}
+
+// write the buffered rows as a chunk
+
+void QfeMeasLog::Flush() {
+  if (file == nullptr || n_buf == 0) return;
+  uint32_t n_rows = n_buf;
+  fwrite(&n_rows, sizeof(uint32_t), 1, file);
+  std::vector<float> buf_f(use_float ? n_buf : 0);
+  for (int i = 0; i < n_cols; i++) {
+    const double* col = &buf[long(i) * chunk_rows];
+    if (use_float) {
+      for (int j = 0; j < n_buf; j++) buf_f[j] = col[j];
+      fwrite(buf_f.data(), sizeof(float), n_buf, file);
+    } else {
+      fwrite(col, sizeof(double), n_buf, file);
+    }
+  }
+  fflush(file);
+  n_buf = 0;
+}
+
+void QfeMeasLog::Close() {
+  if (file == nullptr) return;
+  Flush();
+  fclose(file);
+  file = nullptr;
+}
+
+// read-only view of a measurement log. the file is memory mapped, so columns
+// of large logs are read from disk as they are accessed.
+
+class QfeMeasLogReader {
+
+public:
+  QfeMeasLogReader();
+  ~QfeMeasLogReader();
+  QfeMeasLogReader(const QfeMeasLogReader&) = delete;  // owns the mapping
+  QfeMeasLogReader& operator=(const QfeMeasLogReader&) = delete;
+  bool Open(const std::string& path);
+  void Close();
+  int Column(const std::string& name);
+  template <typename F>
+  void ForEach(int col, F f);
+  std::vector<double> Read(int col);
+  void Measure(int col, QfeMeasReal& meas, bool calc_autocorr = true);
+
+  int n_rows;
+  int n_cols;
+  bool use_float;  // values are stored as 32-bit floats
+  std::vector<std::string> names;  // column names
+  std::map<std::string, std::string> params;  // run parameters
+  std::vector<size_t> chunk_offset;  // offset of the data in each chunk
+  std::vector<int> chunk_n_rows;  // number of rows in each chunk
+
+  const char* data;  // mapped file
+  size_t size;  // size of the mapped file
+};
+
+QfeMeasLogReader::QfeMeasLogReader() {
+  n_rows = 0;
+  n_cols = 0;
+  use_float = false;
+  data = nullptr;
+  size = 0;
+}
+
+QfeMeasLogReader::~QfeMeasLogReader() {
+  Close();
+}
+
+bool QfeMeasLogReader::Open(const std::string& path) {
+  Close();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < 12) {
+    close(fd);
+    return false;
+  }
+  size = st.st_size;
+  void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    size = 0;
+    return false;
+  }
+  data = (const char*)map;
+  madvise(map, size, MADV_SEQUENTIAL);
+
+  uint32_t header_size;
+  memcpy(&header_size, data + 8, sizeof(uint32_t));
+  if (memcmp(data, QFE_MEAS_LOG_MAGIC, 8) != 0 || 12 + header_size > size) {
+    fprintf(stderr, "invalid measurement log: %s\n", path.c_str());
+    Close();
+    return false;
+  }
+
+  // parse the header
+  std::string header(data + 12, header_size);
+  size_t pos = 0;
+  while (pos < header.size()) {
+    size_t end = header.find('\n', pos);
+    if (end == std::string::npos) end = header.size();
+    std::string line = header.substr(pos, end - pos);
+    pos = end + 1;
+    size_t space = line.find(' ');
+    if (space == std::string::npos) continue;
+    std::string key = line.substr(0, space);
+    std::string value = line.substr(space + 1);
+    if (key == "dtype") {
+      use_float = (value == "f32");
+    } else if (key == "column") {
+      names.push_back(value);
+    } else if (key == "param") {
+      size_t space2 = value.find(' ');
+      params[value.substr(0, space2)] =
+          space2 == std::string::npos ? "" : value.substr(space2 + 1);
+    }
+  }
+  n_cols = names.size();
+
+  // index the chunks
+  size_t value_size = use_float ? sizeof(float) : sizeof(double);
+  size_t offset = 12 + header_size;
+  while (offset + sizeof(uint32_t) <= size) {
+    uint32_t chunk_rows;
+    memcpy(&chunk_rows, data + offset, sizeof(uint32_t));
+    size_t chunk_size = size_t(chunk_rows) * n_cols * value_size;
+    offset += sizeof(uint32_t);
+    if (offset + chunk_size > size) break;  // truncated chunk
+    chunk_offset.push_back(offset);
+    chunk_n_rows.push_back(chunk_rows);
+    n_rows += chunk_rows;
+    offset += chunk_size;
+  }
+  return true;
+}
+
+void QfeMeasLogReader::Close() {
+  if (data != nullptr) munmap((void*)data, size);
+  data = nullptr;
+  size = 0;
+  n_rows = 0;
+  n_cols = 0;
+  names.clear();
+  params.clear();
+  chunk_offset.clear();
+  chunk_n_rows.clear();
+}
+
+// index of a column by name (-1 if not found)
+
+int QfeMeasLogReader::Column(const std::string& name) {
+  for (int i = 0; i < n_cols; i++) {
+    if (names[i] == name) return i;
   }
+  return -1;
+}
+
+// call f(value) for each row of a column, in order
+
+template <typename F>
+void QfeMeasLogReader::ForEach(int col, F f) {
+  for (int c = 0; c < chunk_offset.size(); c++) {
+    int rows = chunk_n_rows[c];
+    if (use_float) {
+      const char* p =
+          data + chunk_offset[c] + size_t(col) * rows * sizeof(float);
+      for (int j = 0; j < rows; j++) {
+        float value;
+        memcpy(&value, p + j * sizeof(float), sizeof(float));
+        f(double(value));
+      }
+    } else {
+      const char* p =
+          data + chunk_offset[c] + size_t(col) * rows * sizeof(double);
+      for (int j = 0; j < rows; j++) {
+        double value;
+        memcpy(&value, p + j * sizeof(double), sizeof(double));
+        f(value);
+      }
+    }
+  }
+}
+
+// copy a column into a vector, e.g. for Jackknife or AutocorrTimeWindowed
+
+std::vector<double> QfeMeasLogReader::Read(int col) {
+  std::vector<double> a;
+  a.reserve(n_rows);
+  ForEach(col, [&](double value) { a.push_back(value); });
+  return a;
+}
+
+// add every value of a column to a measurement
 
-  return result / Gamma0;
+void QfeMeasLogReader::Measure(int col, QfeMeasReal& meas,
+                               bool calc_autocorr) {
+  ForEach(col, [&](double value) { meas.Measure(value, calc_autocorr); });
 }
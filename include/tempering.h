@@ -0,0 +1,301 @@
+// tempering.h
+
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#include "ising.h"
+#include "lattice.h"
+#include "parallel.h"
+#include "phi4.h"
+#include "rng.h"
+#include "statistics.h"
+
+/// @brief Coupling that is exchanged between replicas of a field. The action
+/// must be linear in the coupling, so that the swap acceptance only depends on
+/// the conjugate dS/dc of each replica. Specialize this for each field type.
+template <class Field>
+struct QfeTemperingTraits;
+
+/// @brief Ising replicas exchange beta
+template <>
+struct QfeTemperingTraits<QfeIsing> {
+  static double Coupling(const QfeIsing& field) { return field.beta; }
+
+  /// @brief Conjugate of beta, i.e. the total action divided by beta
+  static double Conjugate(QfeIsing& field) {
+    if (field.tracking && field.beta != 0.0) {
+      return field.track_action / field.beta;
+    }
+    QfeLattice* lattice = field.lattice;
+    lattice->SyncAdjacency();
+    const int* adj_offset = lattice->adj_offset.data();
+    const int* adj_sites = lattice->adj_sites.data();
+    const double* adj_wt = lattice->adj_wt.data();
+    double sum = 0.0;
+    for (int s = 0; s < lattice->n_sites; s++) {
+      double spin_sum = 0.0;
+      for (int i = adj_offset[s]; i < adj_offset[s + 1]; i++) {
+        spin_sum += field.spin[adj_sites[i]] * adj_wt[i];
+      }
+      sum -= 0.5 * field.spin[s] * spin_sum;
+    }
+    return sum;
+  }
+
+  static void SetCoupling(QfeIsing& field, double beta) {
+    if (field.tracking) {
+      if (field.beta != 0.0) {
+        field.track_action *= beta / field.beta;
+        field.beta = beta;
+      } else {
+        field.beta = beta;
+        field.SyncTracking();
+      }
+      return;
+    }
+    field.beta = beta;
+  }
+};
+
+/// @brief phi4 replicas exchange the bare mass squared
+template <>
+struct QfeTemperingTraits<QfePhi4> {
+  static double Coupling(const QfePhi4& field) { return field.msq; }
+
+  /// @brief Conjugate of msq, i.e. half the weighted sum of phi^2
+  static double Conjugate(QfePhi4& field) {
+    if (field.tracking) return 0.5 * field.track_phi2;
+    double sum = 0.0;
+    for (int s = 0; s < field.lattice->n_sites; s++) {
+      sum += field.phi[s] * field.phi[s] * field.lattice->sites[s].wt;
+    }
+    return 0.5 * sum;
+  }
+
+  static void SetCoupling(QfePhi4& field, double msq) {
+    if (field.tracking) {
+      field.track_action += 0.5 * (msq - field.msq) * field.track_phi2;
+    }
+    field.msq = msq;
+  }
+};
+
+/// @brief Parallel tempering (replica exchange) over a ladder of couplings.
+/// All replicas share one lattice, and each has its own random number
+/// generators (see QfeChainRng). Replicas are updated in parallel, and swaps
+/// are proposed between replicas at neighboring couplings. Rather than
+/// copying field configurations, an accepted swap exchanges the couplings of
+/// the two replicas, so Replica(k) always returns the replica that is
+/// currently at coupling k.
+/// ref: K. Hukushima and K. Nemoto, J. Phys. Soc. Jpn. 65, 1604 (1996).
+template <class Field>
+class QfeTempering {
+ public:
+  typedef QfeTemperingTraits<Field> Traits;
+
+  template <typename Make>
+  QfeTempering(QfeLattice* lattice, const std::vector<double>& couplings,
+               Make make);
+  void SeedRng(unsigned int seed);
+  Field& Replica(int k);
+  double Coupling(int k);
+  template <typename Update>
+  void Sweep(Update update, int n_threads = 0);
+  int Swap();
+  double SwapRate(int k);
+  void ResetSwapRates();
+  void AdjustLadder(double damping = 0.5);
+
+  int n_replicas;
+  std::vector<double> couplings;     // coupling ladder (monotonic)
+  std::vector<QfeChainRng> rngs;     // generators for each replica
+  std::vector<Field> replicas;       // fields (indexed by replica)
+  std::vector<int> slot_replica;     // replica at each coupling
+  std::vector<int> replica_slot;     // coupling of each replica
+  std::vector<QfeMeasReal> swap_accept;  // acceptance between k and k + 1
+  int swap_parity;  // propose even (0) or odd (1) pairs in the next Swap
+
+  // round trips between the two ends of the ladder. each replica is labeled
+  // by the last end it visited (0 for none, +1 for the first coupling, -1 for
+  // the last coupling), and a round trip is counted when a replica labeled +1
+  // reaches the first coupling again after visiting the last coupling.
+  std::vector<int> replica_label;
+  int n_round_trips;
+
+  QfeRng rng;  // random number generator for swap proposals
+};
+
+/// @brief Parallel tempering constructor
+/// @param lattice Lattice shared by the replicas (must not be modified while
+/// the replicas are in use)
+/// @param couplings Coupling for each replica (monotonic)
+/// @param make Function that returns a field given a lattice and a coupling,
+/// e.g. [](QfeLattice* l, double beta) { return QfeIsing(l, beta); }
+template <class Field>
+template <typename Make>
+QfeTempering<Field>::QfeTempering(QfeLattice* lattice,
+                                  const std::vector<double>& couplings,
+                                  Make make) {
+  n_replicas = couplings.size();
+  assert(n_replicas >= 1);
+  this->couplings = couplings;
+
+  // the lattice is read concurrently by the replicas, so build the adjacency
+  // and coloring now. the generators must not move once the fields point to
+  // them.
+  lattice->SyncAdjacency();
+  lattice->SyncColoring();
+  rngs.resize(n_replicas);
+  replicas.reserve(n_replicas);
+  for (int r = 0; r < n_replicas; r++) {
+    replicas.push_back(make(lattice, couplings[r]));
+    replicas[r].SetRng(&rngs[r]);
+  }
+
+  slot_replica.resize(n_replicas);
+  replica_slot.resize(n_replicas);
+  replica_label.resize(n_replicas, 0);
+  for (int r = 0; r < n_replicas; r++) {
+    slot_replica[r] = r;
+    replica_slot[r] = r;
+  }
+  replica_label[0] = 1;
+  if (n_replicas > 1) replica_label[n_replicas - 1] = -1;
+  n_round_trips = 0;
+
+  swap_accept.resize(std::max(n_replicas - 1, 0));
+  swap_parity = 0;
+  SeedRng(lattice->rng.gen());
+}
+
+/// @brief Seed the swap generator and the generators of each replica. Each
+/// replica gets a different seed.
+/// @param seed Random seed
+template <class Field>
+void QfeTempering<Field>::SeedRng(unsigned int seed) {
+  rng = QfeRng(seed);
+  for (int r = 0; r < n_replicas; r++) {
+    rngs[r].SeedRng(rng.gen());
+  }
+}
+
+/// @brief Replica that is currently at coupling @p k
+template <class Field>
+Field& QfeTempering<Field>::Replica(int k) {
+  return replicas[slot_replica[k]];
+}
+
+/// @brief Coupling @p k of the ladder
+template <class Field>
+double QfeTempering<Field>::Coupling(int k) {
+  return couplings[k];
+}
+
+/// @brief Update all replicas in parallel. The update function is called as
+/// update(field) for each replica, and should only use the field's own
+/// random number generators (i.e. the field's update methods).
+/// @param update Function that updates a single replica
+/// @param n_threads Number of threads (0 for one per core)
+template <class Field>
+template <typename Update>
+void QfeTempering<Field>::Sweep(Update update, int n_threads) {
+  ParallelFor(n_replicas, n_threads, [&](int r_begin, int r_end, int t) {
+    for (int r = r_begin; r < r_end; r++) update(replicas[r]);
+  });
+}
+
+/// @brief Propose swaps between neighboring couplings. Even pairs (0-1, 2-3,
+/// ...) and odd pairs (1-2, 3-4, ...) are proposed on alternate calls. The
+/// action is linear in the coupling, so a swap between couplings c1 and c2 of
+/// replicas with conjugates E1 and E2 is accepted with probability
+/// min(1, exp((c1 - c2) * (E1 - E2))).
+/// @return Number of accepted swaps
+template <class Field>
+int QfeTempering<Field>::Swap() {
+  int accept = 0;
+  for (int k = swap_parity; k + 1 < n_replicas; k += 2) {
+    int r1 = slot_replica[k];
+    int r2 = slot_replica[k + 1];
+    double c1 = couplings[k];
+    double c2 = couplings[k + 1];
+    double E1 = Traits::Conjugate(replicas[r1]);
+    double E2 = Traits::Conjugate(replicas[r2]);
+    double rate = (c1 - c2) * (E1 - E2);
+    if (rate >= 0.0 || rng.RandReal() < exp(rate)) {
+      Traits::SetCoupling(replicas[r1], c2);
+      Traits::SetCoupling(replicas[r2], c1);
+      slot_replica[k] = r2;
+      slot_replica[k + 1] = r1;
+      replica_slot[r1] = k + 1;
+      replica_slot[r2] = k;
+      swap_accept[k].Measure(1.0, false);
+      accept++;
+    } else {
+      swap_accept[k].Measure(0.0, false);
+    }
+  }
+  swap_parity ^= 1;
+
+  // update the round trip labels
+  if (n_replicas > 1) {
+    int r_first = slot_replica[0];
+    int r_last = slot_replica[n_replicas - 1];
+    if (replica_label[r_first] == -1) n_round_trips++;
+    replica_label[r_first] = 1;
+    replica_label[r_last] = -1;
+  }
+
+  return accept;
+}
+
+/// @brief Swap acceptance rate between couplings @p k and @p k + 1
+template <class Field>
+double QfeTempering<Field>::SwapRate(int k) {
+  return swap_accept[k].Mean();
+}
+
+/// @brief Reset the swap acceptance rates
+template <class Field>
+void QfeTempering<Field>::ResetSwapRates() {
+  for (int k = 0; k < swap_accept.size(); k++) swap_accept[k].Reset();
+}
+
+/// @brief Move the interior couplings toward equal swap acceptance rates.
+/// Each spacing of the ladder is scaled by (A_k / A_mean)^damping, where A_k is
+/// its acceptance rate, then the spacings are rescaled so that the first and
+/// last couplings do not change. This should be called periodically during
+/// thermalization, with enough swaps in between to estimate the rates. The
+/// rates are reset afterwards.
+/// @param damping Power of the acceptance ratio (between 0 and 1)
+template <class Field>
+void QfeTempering<Field>::AdjustLadder(double damping) {
+  int n_gaps = n_replicas - 1;
+  if (n_gaps < 2) return;
+
+  // small offset so that gaps with no accepted swaps still shrink smoothly
+  const double eps = 0.01;
+  double A_mean = 0.0;
+  for (int k = 0; k < n_gaps; k++) {
+    if (swap_accept[k].n == 0) return;
+    A_mean += SwapRate(k) + eps;
+  }
+  A_mean /= n_gaps;
+
+  std::vector<double> gap(n_gaps);
+  double gap_sum = 0.0;
+  for (int k = 0; k < n_gaps; k++) {
+    double ratio = (SwapRate(k) + eps) / A_mean;
+    gap[k] = (couplings[k + 1] - couplings[k]) * pow(ratio, damping);
+    gap_sum += gap[k];
+  }
+
+  double span = couplings[n_gaps] - couplings[0];
+  for (int k = 1; k < n_gaps; k++) {
+    couplings[k] = couplings[k - 1] + gap[k - 1] * span / gap_sum;
+    Traits::SetCoupling(Replica(k), couplings[k]);
+  }
+  ResetSwapRates();
+}
@@ -1,6 +1,21 @@
 // timer.h
 
+#pragma once
+
 #include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(QFE_PERF_COUNTERS) && defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 typedef std::chrono::high_resolution_clock Clock;
 
@@ -42,3 +57,398 @@ double Timer::Duration() {
   }
   return dur.count();
 }
+
+// scoped hierarchical profiler. when QFE_PROFILE is defined, each
+// QFE_PROFILE_SCOPE(name, unit) records the number of calls and the time spent
+// in the enclosing scope, nested under the scope that was active on the same
+// thread. QFE_PROFILE_WORK(n) adds n units of work (e.g. site updates) to the
+// innermost scope, which is reported as a throughput. each thread records into
+// its own buffer, and buffers of threads that have exited are merged into a
+// shared tree, so worker threads only take a lock when they exit. regions
+// entered on worker threads are reported at the top level. when QFE_PROFILE is
+// not defined the macros compile to nothing.
+
+#ifdef QFE_PROFILE
+#define QFE_PROFILE_SCOPE(name, unit)                                  \
+  static int qfe_profile_region = QfeProfiler::Register(name, unit); \
+  QfeProfileScope qfe_profile_scope(qfe_profile_region)
+#define QFE_PROFILE_WORK(n) QfeProfiler::AddWork(n)
+#else
+#define QFE_PROFILE_SCOPE(name, unit)
+#define QFE_PROFILE_WORK(n)
+#endif
+
+// hardware counters recorded for each profiled region if QFE_PERF_COUNTERS is
+// also defined (linux only). if the counters can't be opened, e.g. because of
+// /proc/sys/kernel/perf_event_paranoid or a virtual machine without a pmu,
+// only the wall time is recorded. the counters are opened as one event group,
+// so the kernel always schedules them together and ratios such as
+// instructions per cycle compare counts from the same time windows. if the
+// group is multiplexed with other events, the counts are scaled by
+// time_enabled / time_running to estimate the full counts.
+
+#define QFE_N_COUNTERS 4
+enum QfeCounter {
+  QFE_CYCLES = 0,
+  QFE_INSTRUCTIONS = 1,
+  QFE_LLC_MISSES = 2,
+  QFE_BRANCH_MISSES = 3
+};
+
+// group of hardware counters for the calling thread
+
+class QfePerfCounters {
+
+public:
+  QfePerfCounters();
+  ~QfePerfCounters();
+  void Open();
+  bool Read(double* values);
+
+  bool is_open;  // Open has been called
+  int n_open;  // number of counters that were opened
+  int fd[QFE_N_COUNTERS];  // file descriptor of each counter (-1 if closed)
+  int leader;  // counter that leads the group (-1 if none are open)
+};
+
+struct QfeProfileNode {
+  int region;  // index of the region (-1 for the root)
+  int parent;  // parent node
+  std::vector<int> children;  // child nodes
+  long calls;  // number of times the region was entered
+  double time;  // total time in the region (seconds)
+  double work;  // total units of work
+  double counters[QFE_N_COUNTERS];  // total hardware counts (see QfeCounter)
+};
+
+// a tree of profile nodes (one per thread, plus the merged tree)
+
+class QfeProfileTree {
+
+public:
+  QfeProfileTree();
+  ~QfeProfileTree();
+  void Clear();
+  int Child(int node, int region);
+  void Merge(const QfeProfileTree& other, int other_node = 0, int node = 0);
+
+  std::vector<QfeProfileNode> nodes;
+  int current;  // innermost active node
+  QfePerfCounters perf;  // hardware counters for this thread
+  bool is_thread;  // this tree is a thread buffer
+};
+
+class QfeProfiler {
+
+public:
+  static int Register(const char* name, const char* unit);
+  static QfeProfileTree& ThreadTree();
+  static void AddWork(double n);
+  static void Retire(QfeProfileTree* tree);
+  static void Reset();
+  static void Report(FILE* file = stdout);
+
+  static std::mutex& Mutex();
+  static std::vector<std::string>& Names();
+  static std::vector<std::string>& Units();
+  static std::vector<QfeProfileTree*>& Threads();  // live thread trees
+  static QfeProfileTree& Retired();  // trees of threads that have exited
+
+private:
+  static void ReportNode(FILE* file, const QfeProfileTree& tree, int node,
+                         int depth, double total_time, bool has_counters);
+};
+
+class QfeProfileScope {
+
+public:
+  QfeProfileScope(int region);
+  ~QfeProfileScope();
+
+  QfeProfileTree* tree;
+  int node;
+  Clock::time_point start_time;
+  double start_counters[QFE_N_COUNTERS];
+  bool has_counters;
+};
+
+QfePerfCounters::QfePerfCounters() {
+  is_open = false;
+  n_open = 0;
+  for (int i = 0; i < QFE_N_COUNTERS; i++) fd[i] = -1;
+  leader = -1;
+}
+
+QfePerfCounters::~QfePerfCounters() {
+#if defined(QFE_PERF_COUNTERS) && defined(__linux__)
+  for (int i = 0; i < QFE_N_COUNTERS; i++) {
+    if (fd[i] >= 0) close(fd[i]);
+  }
+#endif
+}
+
+// open the counters for the calling thread. the first counter that can be
+// opened leads the group. counters that are not supported stay closed.
+
+void QfePerfCounters::Open() {
+  is_open = true;
+#if defined(QFE_PERF_COUNTERS) && defined(__linux__)
+  const uint64_t config[QFE_N_COUNTERS] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+  for (int i = 0; i < QFE_N_COUNTERS; i++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config[i];
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    int group_fd = (leader >= 0) ? fd[leader] : -1;
+    fd[i] = syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+    if (fd[i] < 0) continue;
+    if (leader < 0) leader = i;
+    n_open++;
+  }
+#endif
+}
+
+// read the current counts of the whole group from the leader. the group is
+// read as nr, time_enabled, time_running, then one value per open counter in
+// the order they were opened. values of counters that are not open (or were
+// never scheduled) are set to zero. returns false if no counters are open.
+
+bool QfePerfCounters::Read(double* values) {
+  if (!is_open) Open();
+  for (int i = 0; i < QFE_N_COUNTERS; i++) values[i] = 0.0;
+  if (n_open == 0) return false;
+#if defined(QFE_PERF_COUNTERS) && defined(__linux__)
+  uint64_t data[3 + QFE_N_COUNTERS];
+  ssize_t size = (3 + n_open) * sizeof(uint64_t);
+  if (read(fd[leader], data, size) != size) return true;
+  if (data[0] != uint64_t(n_open) || data[2] == 0) return true;
+  double scale = double(data[1]) / double(data[2]);
+  int j = 3;
+  for (int i = 0; i < QFE_N_COUNTERS; i++) {
+    if (fd[i] >= 0) values[i] = double(data[j++]) * scale;
+  }
+#endif
+  return true;
+}
+
+QfeProfileTree::QfeProfileTree() {
+  Clear();
+  is_thread = false;
+}
+
+QfeProfileTree::~QfeProfileTree() {
+  if (is_thread) QfeProfiler::Retire(this);
+}
+
+// remove all nodes except the root
+
+void QfeProfileTree::Clear() {
+  nodes.resize(1);
+  nodes[0].region = -1;
+  nodes[0].parent = -1;
+  nodes[0].children.clear();
+  nodes[0].calls = 0;
+  nodes[0].time = 0.0;
+  nodes[0].work = 0.0;
+  for (int i = 0; i < QFE_N_COUNTERS; i++) nodes[0].counters[i] = 0.0;
+  current = 0;
+}
+
+// find or add the child of a node for a region
+
+int QfeProfileTree::Child(int node, int region) {
+  for (int c : nodes[node].children) {
+    if (nodes[c].region == region) return c;
+  }
+  int c = nodes.size();
+  QfeProfileNode child;
+  child.region = region;
+  child.parent = node;
+  child.calls = 0;
+  child.time = 0.0;
+  child.work = 0.0;
+  for (int i = 0; i < QFE_N_COUNTERS; i++) child.counters[i] = 0.0;
+  nodes.push_back(child);
+  nodes[node].children.push_back(c);
+  return c;
+}
+
+// add the totals of another tree, matching nodes by their region path
+
+void QfeProfileTree::Merge(const QfeProfileTree& other, int other_node,
+                           int node) {
+  const QfeProfileNode& src = other.nodes[other_node];
+  nodes[node].calls += src.calls;
+  nodes[node].time += src.time;
+  nodes[node].work += src.work;
+  for (int i = 0; i < QFE_N_COUNTERS; i++) {
+    nodes[node].counters[i] += src.counters[i];
+  }
+  for (int c : src.children) {
+    int child = Child(node, other.nodes[c].region);
+    Merge(other, c, child);
+  }
+}
+
+std::mutex& QfeProfiler::Mutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+std::vector<std::string>& QfeProfiler::Names() {
+  static std::vector<std::string> names;
+  return names;
+}
+
+std::vector<std::string>& QfeProfiler::Units() {
+  static std::vector<std::string> units;
+  return units;
+}
+
+std::vector<QfeProfileTree*>& QfeProfiler::Threads() {
+  static std::vector<QfeProfileTree*> threads;
+  return threads;
+}
+
+QfeProfileTree& QfeProfiler::Retired() {
+  static QfeProfileTree retired;
+  return retired;
+}
+
+// add a region and return its index. this is called once per call site.
+
+int QfeProfiler::Register(const char* name, const char* unit) {
+  std::lock_guard<std::mutex> lock(Mutex());
+  Names().push_back(name);
+  Units().push_back(unit);
+  return Names().size() - 1;
+}
+
+QfeProfileTree& QfeProfiler::ThreadTree() {
+  thread_local QfeProfileTree* tree = nullptr;
+  thread_local QfeProfileTree buffer;
+  if (tree == nullptr) {
+    tree = &buffer;
+    buffer.is_thread = true;
+    std::lock_guard<std::mutex> lock(Mutex());
+    Threads().push_back(tree);
+  }
+  return *tree;
+}
+
+void QfeProfiler::AddWork(double n) {
+  QfeProfileTree& tree = ThreadTree();
+  tree.nodes[tree.current].work += n;
+}
+
+// merge the tree of a thread that is exiting
+
+void QfeProfiler::Retire(QfeProfileTree* tree) {
+  std::lock_guard<std::mutex> lock(Mutex());
+  std::vector<QfeProfileTree*>& threads = Threads();
+  for (int i = 0; i < threads.size(); i++) {
+    if (threads[i] != tree) continue;
+    threads.erase(threads.begin() + i);
+    Retired().Merge(*tree);
+    break;
+  }
+}
+
+// clear all totals. this should only be called while no regions are active.
+
+void QfeProfiler::Reset() {
+  std::lock_guard<std::mutex> lock(Mutex());
+  Retired().Clear();
+  for (QfeProfileTree* tree : Threads()) tree->Clear();
+}
+
+// print the merged totals of all threads as an indented tree
+
+void QfeProfiler::Report(FILE* file) {
+  std::lock_guard<std::mutex> lock(Mutex());
+  QfeProfileTree total;
+  total.Merge(Retired());
+  for (QfeProfileTree* tree : Threads()) total.Merge(*tree);
+
+  double total_time = 0.0;
+  double total_cycles = 0.0;
+  for (int c : total.nodes[0].children) {
+    total_time += total.nodes[c].time;
+    total_cycles += total.nodes[c].counters[QFE_CYCLES];
+  }
+  bool has_counters = total_cycles > 0.0;
+
+#ifdef QFE_PERF_COUNTERS
+  if (!has_counters) {
+    fprintf(file, "hardware counters unavailable (wall time only)\n");
+  }
+#endif
+
+  // the miss columns are per unit of work (e.g. per site update)
+  fprintf(file, "%-40s %10s %12s %7s", "region", "calls", "time (s)", "%");
+  if (has_counters) {
+    fprintf(file, " %6s %10s %10s", "IPC", "LLC/unit", "br/unit");
+  }
+  fprintf(file, " %s\n", "throughput");
+  for (int c : total.nodes[0].children) {
+    ReportNode(file, total, c, 0, total_time, has_counters);
+  }
+}
+
+void QfeProfiler::ReportNode(FILE* file, const QfeProfileTree& tree, int node,
+                             int depth, double total_time, bool has_counters) {
+  const QfeProfileNode& n = tree.nodes[node];
+  std::string label = std::string(2 * depth, ' ') + Names()[n.region];
+  double percent = total_time > 0.0 ? 100.0 * n.time / total_time : 0.0;
+  fprintf(file, "%-40s %10ld %12.4f %7.2f", label.c_str(), n.calls, n.time,
+          percent);
+  if (has_counters) {
+    double cycles = n.counters[QFE_CYCLES];
+    double ipc = cycles > 0.0 ? n.counters[QFE_INSTRUCTIONS] / cycles : 0.0;
+    double work = n.work > 0.0 ? n.work : 1.0;
+    fprintf(file, " %6.3f %10.4f %10.4f", ipc,
+            n.counters[QFE_LLC_MISSES] / work,
+            n.counters[QFE_BRANCH_MISSES] / work);
+  }
+  if (n.work > 0.0 && n.time > 0.0) {
+    fprintf(file, " %.4e %s/s", n.work / n.time, Units()[n.region].c_str());
+  }
+  fprintf(file, "\n");
+  for (int c : n.children) {
+    ReportNode(file, tree, c, depth + 1, total_time, has_counters);
+  }
+}
+
+QfeProfileScope::QfeProfileScope(int region) {
+  tree = &QfeProfiler::ThreadTree();
+  node = tree->Child(tree->current, region);
+  tree->current = node;
+#ifdef QFE_PERF_COUNTERS
+  has_counters = tree->perf.Read(start_counters);
+#else
+  has_counters = false;
+#endif
+  start_time = Clock::now();
+}
+
+QfeProfileScope::~QfeProfileScope() {
+  std::chrono::duration<double> dur = Clock::now() - start_time;
+  QfeProfileNode& n = tree->nodes[node];
+  n.time += dur.count();
+  n.calls++;
+  if (has_counters) {
+    double stop_counters[QFE_N_COUNTERS];
+    tree->perf.Read(stop_counters);
+    for (int i = 0; i < QFE_N_COUNTERS; i++) {
+      n.counters[i] += stop_counters[i] - start_counters[i];
+    }
+  }
+  tree->current = n.parent;
+}
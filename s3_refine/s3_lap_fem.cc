@@ -99,6 +99,7 @@ int main(int argc, char* argv[]) {
       }
     }
   }
+  lattice.UpdateAdjacency();
 
   // lattice.PrintSites();
   // lattice.PrintLinks();
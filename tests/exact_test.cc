@@ -0,0 +1,203 @@
+// exact_test.cc
+
+#include "exact.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <string>
+
+#include "ising.h"
+#include "lattice.h"
+#include "phi4.h"
+#include "s2.h"
+#include "statistics.h"
+
+// Compare Monte Carlo estimates of <S>, <m^2>, and <m^4> from each update
+// kernel with exact values on small lattices with non-uniform link weights.
+// The ising model is enumerated exactly, and phi4 is checked at lambda = 0,
+// where the field is gaussian. This only takes a few seconds, so it can be
+// used to check optimized kernels.
+
+int n_checks = 0;
+int n_failed = 0;
+
+// compare a measurement with its exact value, with the error estimated from
+// logarithmic binning to account for autocorrelation
+void Check(const std::string& name, QfeMeasReal& meas, double exact) {
+  double err = meas.BinnedError();
+  double n_sigma = fabs(meas.Mean() - exact) / err;
+  printf("%-36s %+.6e %.2e exact: %+.6e (%.1f sigma)\n", name.c_str(),
+         meas.Mean(), err, exact, n_sigma);
+  n_checks++;
+  if (!(n_sigma < 5.0)) n_failed++;
+}
+
+void CheckIsing(QfeLattice& lattice, const std::string& lattice_name,
+                double beta, const std::string& kernel_name,
+                std::function<void(QfeIsing&)> update, int n_traj) {
+  QfeIsing field(&lattice, beta);
+  field.HotStart();
+  for (int n = 0; n < 1000; n++) update(field);
+
+  QfeMeasReal action;
+  QfeMeasReal mag2;
+  QfeMeasReal mag4;
+  for (int n = 0; n < n_traj; n++) {
+    update(field);
+    double m = field.MeanSpin();
+    action.Measure(field.Action());
+    mag2.Measure(m * m);
+    mag4.Measure(m * m * m * m);
+  }
+
+  QfeExact exact;
+  exact.Ising(&lattice, beta);
+  std::string name = lattice_name + " ising." + kernel_name;
+  Check(name + " S", action, exact.action);
+  Check(name + " m^2", mag2, exact.mag2);
+  Check(name + " m^4", mag4, exact.mag4);
+}
+
+// the multi-spin coded engine updates 64 independent replicas at once. on
+// lattices with too many link weights it updates them one at a time.
+void CheckIsingMultiSpin(QfeLattice& lattice, const std::string& lattice_name,
+                         double beta, int n_traj) {
+  QfeIsingMultiSpin field(&lattice, beta);
+  field.HotStart();
+  for (int n = 0; n < 1000; n++) field.Metropolis();
+
+  QfeMeasReal action;
+  QfeMeasReal mag2;
+  QfeMeasReal mag4;
+  for (int n = 0; n < n_traj; n++) {
+    field.Metropolis();
+    for (int r = 0; r < 64; r++) {
+      double m = field.MeanSpin(r);
+      action.Measure(field.Action(r));
+      mag2.Measure(m * m);
+      mag4.Measure(m * m * m * m);
+    }
+  }
+
+  QfeExact exact;
+  exact.Ising(&lattice, beta);
+  std::string name = lattice_name + " ising.MultiSpin";
+  if (!field.multi_spin) name += "Fallback";
+  Check(name + " S", action, exact.action);
+  Check(name + " m^2", mag2, exact.mag2);
+  Check(name + " m^4", mag4, exact.mag4);
+}
+
+void CheckGaussian(QfeLattice& lattice, const std::string& lattice_name,
+                   double msq, const std::string& kernel_name,
+                   std::function<void(QfePhi4&)> update, int n_traj) {
+  QfePhi4 field(&lattice, msq, 0.0);
+  field.HotStart();
+  for (int n = 0; n < 1000; n++) update(field);
+
+  QfeMeasReal action;
+  QfeMeasReal mag2;
+  QfeMeasReal mag4;
+  for (int n = 0; n < n_traj; n++) {
+    update(field);
+    double m = field.MeanPhi();
+    action.Measure(field.Action());
+    mag2.Measure(m * m);
+    mag4.Measure(m * m * m * m);
+  }
+
+  QfeExact exact;
+  exact.Gaussian(&lattice, msq);
+  std::string name = lattice_name + " phi4." + kernel_name;
+  Check(name + " S", action, exact.action);
+  Check(name + " m^2", mag2, exact.mag2);
+  Check(name + " m^4", mag4, exact.mag4);
+}
+
+void CheckLattice(QfeLattice& lattice, const std::string& lattice_name) {
+  lattice.SeedRng(1234);
+  int n_traj = 100000;
+  double beta = 0.35;
+  double msq = 0.5;
+
+  CheckIsing(lattice, lattice_name, beta, "Metropolis",
+             [](QfeIsing& field) { field.Metropolis(); }, n_traj);
+  CheckIsing(lattice, lattice_name, beta, "ParallelMetropolis",
+             [](QfeIsing& field) { field.ParallelMetropolis(2); }, n_traj);
+  CheckIsing(lattice, lattice_name, beta, "WolffUpdate",
+             [](QfeIsing& field) { field.WolffUpdate(); }, n_traj);
+  CheckIsing(lattice, lattice_name, beta, "SWUpdate",
+             [](QfeIsing& field) { field.SWUpdate(); }, n_traj);
+  CheckIsing(lattice, lattice_name, beta, "ParallelSWUpdate",
+             [](QfeIsing& field) { field.ParallelSWUpdate(2); }, n_traj);
+  CheckIsingMultiSpin(lattice, lattice_name, beta, n_traj / 64);
+
+  CheckGaussian(lattice, lattice_name, msq, "Metropolis",
+                [](QfePhi4& field) { field.Metropolis(); }, n_traj);
+  CheckGaussian(lattice, lattice_name, msq, "Overrelax",
+                [](QfePhi4& field) {
+                  field.Metropolis();
+                  field.Overrelax();
+                }, n_traj);
+  CheckGaussian(lattice, lattice_name, msq, "ParallelOverrelax",
+                [](QfePhi4& field) {
+                  field.ParallelMetropolis(2);
+                  field.ParallelOverrelax(2);
+                }, n_traj);
+  CheckGaussian(lattice, lattice_name, msq, "WolffUpdate",
+                [](QfePhi4& field) {
+                  field.Metropolis();
+                  field.WolffUpdate();
+                }, n_traj);
+  CheckGaussian(lattice, lattice_name, msq, "SWUpdate",
+                [](QfePhi4& field) {
+                  field.Metropolis();
+                  field.SWUpdate();
+                }, n_traj);
+  CheckGaussian(lattice, lattice_name, msq, "ParallelSWUpdate",
+                [](QfePhi4& field) {
+                  field.ParallelMetropolis(2);
+                  field.ParallelSWUpdate(2);
+                }, n_traj);
+}
+
+int main(int argc, char* argv[]) {
+  // two spins joined by a link of weight w have <s_0 s_1> = tanh(beta w)
+  double beta = 0.7;
+  double wt = 0.6;
+  QfeLattice pair;
+  pair.ResizeSites(2);
+  pair.sites[0].wt = 1.0;
+  pair.sites[1].wt = 1.0;
+  pair.vol = 2.0;
+  pair.AddLink(0, 1, wt);
+  QfeExact exact;
+  exact.Ising(&pair, beta);
+  double corr = tanh(beta * wt);
+  assert(fabs(exact.action + 0.5 * beta * wt * corr) < 1.0e-14);
+  assert(fabs(exact.mag2 - 0.5 * (1.0 + corr)) < 1.0e-14);
+  assert(fabs(exact.mag4 - 0.5 * (1.0 + corr)) < 1.0e-14);
+
+  QfeLattice rect;
+  rect.InitRect(4, 4, 1.0, 0.5);
+  CheckLattice(rect, "rect_4x4");
+
+  QfeLattice triangle;
+  triangle.InitTriangle(4, 1.0, 0.7, 0.4);
+  CheckLattice(triangle, "triangle_4x4");
+
+  // tetrahedron
+  QfeLatticeS2 s2_k1(3, 1);
+  s2_k1.UpdateWeights();
+  CheckLattice(s2_k1, "s2_q3k1");
+
+  QfeLatticeS2 s2_k2(3, 2);
+  s2_k2.UpdateWeights();
+  CheckLattice(s2_k2, "s2_q3k2");
+
+  printf("%d of %d checks failed\n", n_failed, n_checks);
+  assert(n_failed == 0);
+  return 0;
+}
@@ -2,6 +2,7 @@
 
 #include "ising.h"
 
+#include <cassert>
 #include <cmath>
 #include <cstdio>
 #include <vector>
@@ -29,6 +30,72 @@ int main(int argc, char* argv[]) {
   QfeLattice lattice;
   lattice.InitTriangle(N, 1.0, 1.0, 1.0);
 
+  // check that neighboring sites never share a color
+  lattice.UpdateColoring();
+  printf("n_colors: %d\n", lattice.n_colors);
+  for (int l = 0; l < lattice.n_links; l++) {
+    int s_a = lattice.links[l].sites[0];
+    int s_b = lattice.links[l].sites[1];
+    assert(lattice.site_color[s_a] != lattice.site_color[s_b]);
+  }
+
+  // check that parallel sweeps do not depend on the number of threads
+  QfeLattice lattice_1t = lattice;
+  QfeLattice lattice_4t = lattice;
+  QfeIsing field_1t(&lattice_1t, beta);
+  QfeIsing field_4t(&lattice_4t, beta);
+  field_1t.HotStart();
+  field_4t.HotStart();
+  for (int n = 0; n < 10; n++) {
+    field_1t.ParallelMetropolis(1);
+    field_4t.ParallelMetropolis(4);
+    field_1t.ParallelSWUpdate(1);
+    field_4t.ParallelSWUpdate(4);
+  }
+  assert(field_1t.spin == field_4t.spin);
+
+  // check that every site points directly at the root of its cluster
+  for (int s = 0; s < lattice.n_sites; s++) {
+    int r = field_4t.sw_root[s];
+    assert(field_4t.sw_root[r] == r);
+  }
+  assert(field_1t.SWClusterSusceptibility() ==
+         field_4t.SWClusterSusceptibility());
+
+  // check that the tracked action and magnetization follow the updates
+  field_1t.StartTracking(1000000);
+  for (int n = 0; n < 20; n++) {
+    field_1t.Metropolis();
+    field_1t.WolffUpdate();
+  }
+  assert(fabs(field_1t.TrackedAction() - field_1t.Action()) < 1.0e-10);
+  assert(fabs(field_1t.TrackedMeanSpin() - field_1t.MeanSpin()) < 1.0e-10);
+
+  // check the multi-spin coded engine against the ordinary metropolis update
+  // on a small lattice away from the critical point
+  QfeLattice small_lattice;
+  small_lattice.InitTriangle(16, 1.0, 1.0, 1.0);
+  QfeIsingMultiSpin msc_field(&small_lattice, 0.2);
+  QfeIsing ref_field(&small_lattice, 0.2);
+  assert(msc_field.multi_spin);  // 3 link weights, so no fallback
+  msc_field.HotStart();
+  ref_field.HotStart();
+  QfeMeasReal msc_action;
+  QfeMeasReal ref_action;
+  for (int n = 0; n < 5000; n++) {
+    msc_field.Metropolis();
+    for (int r = 0; r < 64; r++) ref_field.Metropolis();
+    if (n < 500) continue;
+    for (int r = 0; r < 64; r++) msc_action.Measure(msc_field.Action(r));
+    ref_action.Measure(ref_field.Action());
+  }
+  double msc_err = msc_action.BinnedError();
+  double ref_err = ref_action.BinnedError();
+  printf("msc action: %.6f %.6f\n", msc_action.Mean(), msc_err);
+  printf("ref action: %.6f %.6f\n", ref_action.Mean(), ref_err);
+  assert(fabs(msc_action.Mean() - ref_action.Mean()) <
+         5.0 * hypot(msc_err, ref_err));
+
   QfeIsing field(&lattice, beta);
   field.HotStart();
 
@@ -41,6 +108,9 @@ int main(int argc, char* argv[]) {
   QfeMeasReal action;
   QfeMeasReal cluster_size;
   QfeMeasReal accept_metropolis;
+  QfeMeasReal imp_m2;      // improved estimator from the wolff clusters
+  QfeMeasReal imp_sw_m2;   // improved estimator from the sw clusters
+  QfeMeasReal imp_psw_m2;  // improved estimator from the parallel sw clusters
 
   int n_therm = 5000;
   int n_traj = 20000;
@@ -51,6 +121,7 @@ int main(int argc, char* argv[]) {
     int cluster_size_sum = 0;
     for (int j = 0; j < n_wolff; j++) {
       cluster_size_sum += field.WolffUpdate();
+      if (n >= n_therm) imp_m2.Measure(field.ClusterSusceptibility());
     }
     double metropolis_sum = 0.0;
     for (int j = 0; j < n_metropolis; j++) {
@@ -61,6 +132,9 @@ int main(int argc, char* argv[]) {
 
     if (n % n_skip || n < n_therm) continue;
     field.SWUpdate();
+    imp_sw_m2.Measure(field.SWClusterSusceptibility());
+    field.ParallelSWUpdate(4);
+    imp_psw_m2.Measure(field.SWClusterSusceptibility());
 
     action.Measure(field.Action());
     double m = fabs(field.MeanSpin());
@@ -102,5 +176,20 @@ int main(int argc, char* argv[]) {
       sqrt(pow(m2_err, 2.0) + pow(2.0 * m_mean * m_err, 2.0)) * lattice.vol;
   printf("m_susc: %.12e %.12e\n", m_susc_mean, m_susc_err);
 
+  // improved estimators should agree with V <m^2>
+  double vm2_mean = m2_mean * lattice.vol;
+  double vm2_err = m2_err * lattice.vol;
+  printf("V m^2: %.12e %.12e\n", vm2_mean, vm2_err);
+  printf("V m^2 (wolff): %.12e %.12e\n", imp_m2.Mean(), imp_m2.Error());
+  printf("V m^2 (sw): %.12e %.12e\n", imp_sw_m2.Mean(), imp_sw_m2.Error());
+  printf("V m^2 (parallel sw): %.12e %.12e\n", imp_psw_m2.Mean(),
+         imp_psw_m2.Error());
+  assert(fabs(imp_m2.Mean() - vm2_mean) <
+         5.0 * hypot(imp_m2.Error(), vm2_err));
+  assert(fabs(imp_sw_m2.Mean() - vm2_mean) <
+         5.0 * hypot(imp_sw_m2.Error(), vm2_err));
+  assert(fabs(imp_psw_m2.Mean() - vm2_mean) <
+         5.0 * hypot(imp_psw_m2.Error(), vm2_err));
+
   return 0;
 }
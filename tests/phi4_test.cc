@@ -1,5 +1,6 @@
 // lattice_test.cc
 
+#include <cassert>
 #include <cmath>
 #include <cstdio>
 #include <vector>
@@ -33,6 +34,42 @@ int main(int argc, char* argv[]) {
   lattice.InitRect(N, N, 1.0, 1.0);
   double vol = lattice.vol;
 
+  // check that parallel sweeps do not depend on the number of threads
+  QfeLattice lattice_1t = lattice;
+  QfeLattice lattice_4t = lattice;
+  QfePhi4 field_1t(&lattice_1t, msq, lambda);
+  QfePhi4 field_4t(&lattice_4t, msq, lambda);
+  field_1t.HotStart();
+  field_4t.HotStart();
+  for (int n = 0; n < 10; n++) {
+    field_1t.ParallelMetropolis(1);
+    field_1t.ParallelOverrelax(1);
+    field_4t.ParallelMetropolis(4);
+    field_4t.ParallelOverrelax(4);
+    field_1t.ParallelSWUpdate(1);
+    field_4t.ParallelSWUpdate(4);
+  }
+  assert(field_1t.phi == field_4t.phi);
+  assert(field_1t.overrelax_demon == field_4t.overrelax_demon);
+
+  // check that every site points directly at the root of its cluster
+  for (int s = 0; s < lattice.n_sites; s++) {
+    int r = field_4t.sw_root[s];
+    assert(field_4t.sw_root[r] == r);
+  }
+  assert(field_1t.SWClusterSusceptibility() ==
+         field_4t.SWClusterSusceptibility());
+
+  // check that the tracked action and magnetization follow the updates
+  field_1t.StartTracking(1000000);
+  for (int n = 0; n < 20; n++) {
+    field_1t.Metropolis();
+    field_1t.Overrelax();
+    field_1t.WolffUpdate();
+  }
+  assert(fabs(field_1t.TrackedAction() - field_1t.Action()) < 1.0e-10);
+  assert(fabs(field_1t.TrackedMeanPhi() - field_1t.MeanPhi()) < 1.0e-10);
+
   QfePhi4 field(&lattice, msq, lambda);
   field.HotStart();
   field.metropolis_z = 2.0;
@@ -48,6 +85,7 @@ int main(int argc, char* argv[]) {
   QfeMeasReal cluster_size;
   QfeMeasReal accept_metropolis;
   QfeMeasReal accept_overrelax;
+  QfeMeasReal imp_psw_m2;  // improved estimator from the parallel sw clusters
 
   int n_therm = 5000;
   int n_traj = 20000;
@@ -70,6 +108,8 @@ int main(int argc, char* argv[]) {
 
     if (n % n_skip || n < n_therm) continue;
     field.SWUpdate();
+    field.ParallelSWUpdate(4);
+    imp_psw_m2.Measure(field.SWClusterSusceptibility());
 
     action.Measure(field.Action());
     double m = field.MeanPhi();
@@ -113,5 +153,14 @@ int main(int argc, char* argv[]) {
       sqrt(pow(m2_err, 2.0) + pow(2.0 * m_mean * m_err, 2.0)) * vol;
   printf("m_susc: %.12e %.12e\n", m_susc_mean, m_susc_err);
 
+  // the improved estimator should agree with V <m^2>
+  double vm2_mean = m2_mean * vol;
+  double vm2_err = m2_err * vol;
+  printf("V m^2: %.12e %.12e\n", vm2_mean, vm2_err);
+  printf("V m^2 (parallel sw): %.12e %.12e\n", imp_psw_m2.Mean(),
+         imp_psw_m2.Error());
+  assert(fabs(imp_psw_m2.Mean() - vm2_mean) <
+         5.0 * hypot(imp_psw_m2.Error(), vm2_err));
+
   return 0;
 }
@@ -0,0 +1,121 @@
+// rng_test.cc
+
+#include "rng.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "ising.h"
+
+int main(int argc, char* argv[]) {
+  // check the philox known answer values from the Random123 library
+  uint32_t w[4];
+  QfeCounterRng crng_0(0);
+  crng_0.Block(0, 0, 0, w);
+  assert(w[0] == 0x6627e8d5 && w[1] == 0xe169c58d);
+  assert(w[2] == 0xbc57ac4c && w[3] == 0x9b00dbd8);
+
+  QfeCounterRng crng_1(0xffffffffffffffffULL);
+  crng_1.Block(0xffffffffffffffffULL, 0xffffffff, 0xffffffff, w);
+  assert(w[0] == 0x408f276d && w[1] == 0x41c83b0e);
+  assert(w[2] == 0xa20bc7c6 && w[3] == 0x6d5451fd);
+
+  // check that bulk generation matches the stream interface
+  QfeCounterRng crng(1234);
+  int n = 1001;
+  std::vector<double> u(n);
+  crng.FillReal(7, 42, u.data(), n);
+  QfeRngStream stream(crng, 7, 42);
+  double u_sum = 0.0;
+  for (int i = 0; i < n; i++) {
+    assert(u[i] == stream.RandReal());
+    assert(u[i] >= 0.0 && u[i] < 1.0);
+    u_sum += u[i];
+  }
+  printf("mean uniform: %.6f\n", u_sum / n);
+
+  std::vector<double> g(n);
+  crng.FillNormal(7, 42, g.data(), n);
+  double g_sum = 0.0;
+  double g2_sum = 0.0;
+  for (int i = 0; i < n; i++) {
+    g_sum += g[i];
+    g2_sum += g[i] * g[i];
+  }
+  printf("mean normal: %.6f\n", g_sum / n);
+  printf("variance normal: %.6f\n", g2_sum / n);
+
+  // check the moments of the bulk mersenne twister normal distribution
+  QfeRng rng(5678);
+  int n_bulk = 1000000;
+  std::vector<double> z(n_bulk);
+  rng.FillNormal(z.data(), n_bulk);
+  double z_sum = 0.0;
+  double z2_sum = 0.0;
+  double z4_sum = 0.0;
+  for (int i = 0; i < n_bulk; i++) {
+    double z2 = z[i] * z[i];
+    z_sum += z[i];
+    z2_sum += z2;
+    z4_sum += z2 * z2;
+  }
+  printf("ziggurat <z>: %.6f\n", z_sum / n_bulk);
+  printf("ziggurat <z^2>: %.6f\n", z2_sum / n_bulk);
+  printf("ziggurat <z^4>: %.6f\n", z4_sum / n_bulk);
+  assert(fabs(z_sum / n_bulk) < 0.005);
+  assert(fabs(z2_sum / n_bulk - 1.0) < 0.01);
+  assert(fabs(z4_sum / n_bulk - 3.0) < 0.05);
+
+  rng.FillReal(z.data(), n_bulk, -1.0, 1.0);
+  for (int i = 0; i < n_bulk; i++) {
+    assert(z[i] >= -1.0 && z[i] < 1.0);
+  }
+
+  // the bulk uniforms (vectorized if available) match a scalar conversion of
+  // the same words
+  QfeRng rng_a(91011);
+  QfeRng rng_b(91011);
+  std::vector<double> v(n);
+  rng_a.FillReal(v.data(), n, -2.0, 3.0);
+  for (int i = 0; i < n; i++) {
+    uint64_t x = uint64_t(rng_b.gen()) << 32;
+    x |= rng_b.gen();
+    assert(v[i] == -2.0 + double(x >> 11) * (5.0 / 9007199254740992.0));
+  }
+
+  // blocks generated in bulk match blocks generated one at a time
+  std::vector<uint32_t> blocks(4 * 37);
+  crng.Blocks(0x123456789ULL, 0xABCDEF012ULL, 0xFFFFFFF0, 37, blocks.data());
+  for (int b = 0; b < 37; b++) {
+    crng.Block(0x123456789ULL, 0xABCDEF012ULL, 0xFFFFFFF0 + b, w);
+    for (int k = 0; k < 4; k++) assert(blocks[4 * b + k] == w[k]);
+  }
+
+  // with the counter-based generator, parallel sweeps do not depend on the
+  // order in which the sites of each color are visited
+  QfeLattice lattice_a;
+  lattice_a.InitTriangle(32, 1.0, 1.0, 1.0);
+  lattice_a.SeedRng(1234);
+  lattice_a.use_counter_rng = true;
+  QfeLattice lattice_b = lattice_a;
+  lattice_b.UpdateColoring();
+  for (int c = 0; c < lattice_b.n_colors; c++) {
+    std::reverse(lattice_b.color_sites.begin() + lattice_b.color_offset[c],
+                 lattice_b.color_sites.begin() + lattice_b.color_offset[c + 1]);
+  }
+
+  QfeIsing field_a(&lattice_a, 0.25 * log(3.0));
+  QfeIsing field_b(&lattice_b, 0.25 * log(3.0));
+  field_a.ColdStart();
+  field_b.ColdStart();
+  for (int i = 0; i < 10; i++) {
+    field_a.ParallelMetropolis(1);
+    field_b.ParallelMetropolis(3);
+  }
+  assert(field_a.spin == field_b.spin);
+  assert(lattice_a.counter_rng.sweep == 10);
+
+  return 0;
+}
@@ -0,0 +1,133 @@
+// runner_test.cc
+
+#include "runner.h"
+
+#include <sys/stat.h>
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "ising.h"
+#include "phi4.h"
+#include "s2.h"
+#include "statistics.h"
+
+// Independent chains on one shared lattice should give exactly the same
+// results as separate runs on lattices seeded with the same seeds, for any
+// number of threads. Checkpoints written in the data_dir/run_id layout should
+// continue a chain exactly.
+
+void UpdateIsing(QfeIsing& field) {
+  field.Metropolis();
+  field.WolffUpdate();
+  field.SWUpdate();
+}
+
+void UpdatePhi4(QfePhi4& field) {
+  field.Metropolis();
+  field.Overrelax();
+  field.ParallelMetropolis(2);
+  field.ParallelSWUpdate(2);
+  field.WolffUpdate();
+}
+
+int main(int argc, char* argv[]) {
+  QfeLatticeS2 lattice(5, 4);
+  lattice.UpdateWeights();
+  std::vector<unsigned int> seeds = {11, 22, 33, 44, 55};
+  int n_chains = seeds.size();
+  int n_sweeps = 50;
+
+  // reference runs, one lattice per seed
+  std::vector<std::vector<double>> ref_spin(n_chains);
+  std::vector<std::vector<double>> ref_phi(n_chains);
+  for (int c = 0; c < n_chains; c++) {
+    QfeLatticeS2 ref_lattice(5, 4);
+    ref_lattice.UpdateWeights();
+    ref_lattice.SeedRng(seeds[c]);
+    QfeIsing ising(&ref_lattice, 0.3);
+    ising.HotStart();
+    for (int n = 0; n < n_sweeps; n++) UpdateIsing(ising);
+    ref_spin[c] = ising.spin;
+
+    ref_lattice.SeedRng(seeds[c]);
+    QfePhi4 phi4(&ref_lattice, -0.5, 0.25);
+    phi4.HotStart();
+    for (int n = 0; n < n_sweeps; n++) UpdatePhi4(phi4);
+    ref_phi[c] = phi4.phi;
+  }
+
+  for (int n_threads : {1, 3}) {
+    QfeChainRunner<QfeIsing> ising_runner(
+        &lattice, seeds, [](QfeLattice* l) { return QfeIsing(l, 0.3); });
+    ising_runner.Run(
+        [&](QfeIsing& field, int c) {
+          field.HotStart();
+          for (int n = 0; n < n_sweeps; n++) UpdateIsing(field);
+        },
+        n_threads);
+
+    QfeChainRunner<QfePhi4> phi4_runner(
+        &lattice, seeds, [](QfeLattice* l) { return QfePhi4(l, -0.5, 0.25); });
+    phi4_runner.Run(
+        [&](QfePhi4& field, int c) {
+          field.HotStart();
+          for (int n = 0; n < n_sweeps; n++) UpdatePhi4(field);
+        },
+        n_threads);
+
+    for (int c = 0; c < n_chains; c++) {
+      assert(ising_runner.chains[c].spin == ref_spin[c]);
+      assert(phi4_runner.chains[c].phi == ref_phi[c]);
+    }
+  }
+  assert(ref_spin[0] != ref_spin[1]);
+
+  // run half of the sweeps, save, load into a new runner, and finish. the
+  // ising field is completely described by its spins (the phi4 overrelaxation
+  // demon is not saved). the files go in a new temporary directory.
+  char data_dir[] = "/tmp/runner_test_XXXXXX";
+  bool dir_ok = mkdtemp(data_dir) != nullptr;
+  assert(dir_ok);
+  std::string run_dir = std::string(data_dir) + "/chain";
+  {
+    QfeChainRunner<QfeIsing> runner(
+        &lattice, seeds, [](QfeLattice* l) { return QfeIsing(l, 0.3); });
+    runner.data_dir = data_dir;
+
+    // the run directory doesn't exist yet
+    bool saved = runner.Save(0);
+    assert(!saved);
+    mkdir(run_dir.c_str(), 0755);
+
+    runner.Run([&](QfeIsing& field, int c) {
+      bool loaded = runner.Load(c);
+      assert(!loaded);
+      field.HotStart();
+      for (int n = 0; n < n_sweeps / 2; n++) UpdateIsing(field);
+      bool saved = runner.Save(c);
+      assert(saved);
+    });
+  }
+  QfeChainRunner<QfeIsing> runner(
+      &lattice, seeds, [](QfeLattice* l) { return QfeIsing(l, 0.3); });
+  runner.data_dir = data_dir;
+  runner.Run([&](QfeIsing& field, int c) {
+    bool loaded = runner.Load(c);
+    assert(loaded);
+    for (int n = n_sweeps / 2; n < n_sweeps; n++) UpdateIsing(field);
+  });
+  for (int c = 0; c < n_chains; c++) {
+    assert(runner.chains[c].spin == ref_spin[c]);
+    remove(runner.Path(c, "field").c_str());
+    remove(runner.Path(c, "rng").c_str());
+  }
+  rmdir(run_dir.c_str());
+  rmdir(data_dir);
+
+  return 0;
+}
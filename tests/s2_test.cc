@@ -3,6 +3,17 @@
 #include "s2.h"
 
 #include <cstdio>
+#include <cstdlib>
+
+// largest difference between the indices of two linked sites
+int Bandwidth(QfeLattice& lattice) {
+  int bandwidth = 0;
+  for (int l = 0; l < lattice.n_links; l++) {
+    int diff = abs(lattice.links[l].sites[0] - lattice.links[l].sites[1]);
+    if (diff > bandwidth) bandwidth = diff;
+  }
+  return bandwidth;
+}
 
 int main(int argc, char* argv[]) {
   // list of refinement values to test
@@ -71,6 +82,74 @@ int main(int argc, char* argv[]) {
       for (int s = 0; s < lattice.n_sites; s++) {
         assert(AlmostEq(lattice.r[s], check_lattice.r[s]));
       }
+
+      // write the lattice to a binary file
+      temp_file = fopen("temp.dat", "wb");
+      lattice.WriteLatticeBinary(temp_file);
+      fclose(temp_file);
+
+      // read the binary file into a new lattice
+      QfeLatticeS2 binary_lattice(q);
+      bool binary_ok = binary_lattice.ReadLatticeBinary("temp.dat");
+      assert(binary_ok);
+      remove("temp.dat");
+
+      // check that the lattices are identical
+      assert(binary_lattice.n_sites == lattice.n_sites);
+      assert(binary_lattice.n_links == lattice.n_links);
+      assert(binary_lattice.n_faces == lattice.n_faces);
+      assert(binary_lattice.n_cells == lattice.n_cells);
+      assert(binary_lattice.n_distinct == lattice.n_distinct);
+      for (int s = 0; s < lattice.n_sites; s++) {
+        assert(binary_lattice.sites[s].wt == lattice.sites[s].wt);
+        assert(binary_lattice.sites[s].nn == lattice.sites[s].nn);
+        assert(binary_lattice.r[s] == lattice.r[s]);
+      }
+      for (int l = 0; l < lattice.n_links; l++) {
+        assert(binary_lattice.links[l].wt == lattice.links[l].wt);
+        assert(binary_lattice.links[l].sites[0] == lattice.links[l].sites[0]);
+        assert(binary_lattice.links[l].sites[1] == lattice.links[l].sites[1]);
+      }
+
+      // renumber the sites and check that the coordinates and links follow
+      std::vector<int> new_index = binary_lattice.Reorder();
+      for (int s = 0; s < lattice.n_sites; s++) {
+        assert(binary_lattice.r[new_index[s]] == lattice.r[s]);
+      }
+      for (int l = 0; l < lattice.n_links; l++) {
+        int s_a = new_index[lattice.links[l].sites[0]];
+        int s_b = new_index[lattice.links[l].sites[1]];
+        int l_new = binary_lattice.FindLink(s_a, s_b);
+        assert(l_new != -1);
+        assert(binary_lattice.links[l_new].wt == lattice.links[l].wt);
+      }
+
+      // faces keep their indices but refer to the new sites and links
+      for (int f = 0; f < lattice.n_faces; f++) {
+        const QfeFace& face = lattice.faces[f];
+        const QfeFace& new_face = binary_lattice.faces[f];
+        assert(new_face.n_edges == face.n_edges);
+        for (int e = 0; e < face.n_edges; e++) {
+          assert(new_face.sites[e] == new_index[face.sites[e]]);
+          int s_a = new_index[lattice.links[face.edges[e]].sites[0]];
+          int s_b = new_index[lattice.links[face.edges[e]].sites[1]];
+          assert(new_face.edges[e] == binary_lattice.FindLink(s_a, s_b));
+        }
+      }
+
+      // the antipodes and symmetry group elements follow the sites
+      for (int s = 0; s < lattice.n_sites; s++) {
+        int s_new = new_index[s];
+        int antipode_new = new_index[lattice.antipode[s]];
+        assert(binary_lattice.antipode[s_new] == antipode_new);
+        assert(binary_lattice.site_g[s_new] == lattice.site_g[s]);
+      }
+
+      // reordering should not increase the bandwidth
+      int bandwidth = Bandwidth(lattice);
+      int new_bandwidth = Bandwidth(binary_lattice);
+      printf("bandwidth: %d -> %d\n", bandwidth, new_bandwidth);
+      assert(new_bandwidth <= bandwidth);
     }
   }
   return 0;
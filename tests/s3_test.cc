@@ -73,6 +73,34 @@ int main(int argc, char* argv[]) {
       for (int s = 0; s < lattice.n_sites; s++) {
         assert(AlmostEq(lattice.r[s], check_lattice.r[s]));
       }
+
+      // write the lattice to a binary file
+      temp_file = fopen("temp.dat", "wb");
+      lattice.WriteLatticeBinary(temp_file);
+      fclose(temp_file);
+
+      // read the binary file into a new lattice
+      QfeLatticeS3 binary_lattice(q);
+      bool binary_ok = binary_lattice.ReadLatticeBinary("temp.dat");
+      assert(binary_ok);
+      remove("temp.dat");
+
+      // check that the lattices are identical
+      assert(binary_lattice.n_sites == lattice.n_sites);
+      assert(binary_lattice.n_links == lattice.n_links);
+      assert(binary_lattice.n_faces == lattice.n_faces);
+      assert(binary_lattice.n_cells == lattice.n_cells);
+      assert(binary_lattice.n_distinct == lattice.n_distinct);
+      for (int s = 0; s < lattice.n_sites; s++) {
+        assert(binary_lattice.sites[s].wt == lattice.sites[s].wt);
+        assert(binary_lattice.sites[s].nn == lattice.sites[s].nn);
+        assert(binary_lattice.r[s] == lattice.r[s]);
+      }
+      for (int l = 0; l < lattice.n_links; l++) {
+        assert(binary_lattice.links[l].wt == lattice.links[l].wt);
+        assert(binary_lattice.links[l].sites[0] == lattice.links[l].sites[0]);
+        assert(binary_lattice.links[l].sites[1] == lattice.links[l].sites[1]);
+      }
     }
   }
   return 0;
@@ -0,0 +1,279 @@
+// statistics_test.cc
+
+#include "statistics.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ising.h"
+
+// Generate ising model time series on a 16^2 square lattice at a few values
+// of beta near the critical point. The series are combined with
+// multi-histogram reweighting, and the result at a beta in between the runs
+// is compared with an independent run at that beta. The series are also used
+// to check the jackknife.
+
+// run the ising model at a given beta and store the energy and the
+// observables m^2 and m^4 for each configuration
+void RunIsing(QfeLattice& lattice, double beta, int n_traj,
+              std::vector<double>& energy, std::vector<double>& m2,
+              std::vector<double>& m4) {
+  QfeIsing field(&lattice, beta);
+  field.HotStart();
+  for (int n = 0; n < 1000; n++) {
+    field.Metropolis();
+    field.WolffUpdate();
+  }
+
+  energy.clear();
+  m2.clear();
+  m4.clear();
+  for (int n = 0; n < n_traj; n++) {
+    field.Metropolis();
+    field.WolffUpdate();
+    double m = field.MeanSpin();
+    energy.push_back(field.Action() * lattice.vol / beta);
+    m2.push_back(m * m);
+    m4.push_back(m * m * m * m);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  QfeLattice lattice;
+  lattice.InitRect(16, 16, 1.0, 1.0);
+  lattice.SeedRng(1234);
+  int n_traj = 20000;
+
+  QfeReweight rw;
+  std::vector<double> betas = {0.41, 0.43, 0.45};
+  for (int k = 0; k < betas.size(); k++) {
+    std::vector<double> energy, m2, m4;
+    RunIsing(lattice, betas[k], n_traj, energy, m2, m4);
+    rw.AddRun(betas[k], energy, {m2, m4});
+  }
+  int n_iter = rw.Solve(20);
+  printf("wham iterations: %d\n", n_iter);
+  assert(rw.n_unconverged == 0);
+
+  // the partition functions of the full data set and of every jackknife
+  // sample satisfy the wham equations, Z_k = sum_n exp(-c_k E_n) / den_n
+  for (int sample = 0; sample <= rw.n_blocks; sample++) {
+    for (int k = 0; k < rw.n_runs; k++) {
+      double z_sum = 0.0;
+      for (int n = 0; n < rw.energy.size(); n++) {
+        if (rw.block[n] == sample - 1) continue;
+        double log_w = -rw.run_coupling[k] * rw.energy[n];
+        z_sum += exp(log_w - rw.log_den[sample][n] - rw.log_z[sample][k]);
+      }
+      assert(fabs(log(z_sum)) < 1.0e-8);
+    }
+  }
+
+  // reweighting to the coupling of a run should be close to that run
+  double beta = 0.44;
+  double U4_err;
+  double U4_rw = rw.U4(beta, 0, 1, U4_err);
+  printf("U4 (reweighted): %.6f %.6f\n", U4_rw, U4_err);
+  assert(U4_err > 0.0);
+
+  std::vector<double> energy, m2, m4;
+  RunIsing(lattice, beta, n_traj, energy, m2, m4);
+  double U4_direct = U4(m2, m4);
+  double U4_direct_err = JackknifeU4(m2, m4);
+  printf("U4 (direct): %.6f %.6f\n", U4_direct, U4_direct_err);
+  assert(fabs(U4_rw - U4_direct) < 5.0 * hypot(U4_err, U4_direct_err));
+
+  // compare the linear-time jackknife with an explicit delete-one jackknife
+  int n_small = 500;
+  std::vector<double> m2_small(m2.begin(), m2.begin() + n_small);
+  std::vector<double> m4_small(m4.begin(), m4.begin() + n_small);
+  std::vector<double> U4_del(n_small);
+  for (int i = 0; i < n_small; i++) {
+    std::vector<double> m2_del = m2_small;
+    std::vector<double> m4_del = m4_small;
+    m2_del.erase(m2_del.begin() + i);
+    m4_del.erase(m4_del.begin() + i);
+    U4_del[i] = U4(m2_del, m4_del);
+  }
+  double U4_del_mean = Mean(U4_del);
+  double U4_del_err = 0.0;
+  for (int i = 0; i < n_small; i++) {
+    U4_del_err += (U4_del[i] - U4_del_mean) * (U4_del[i] - U4_del_mean);
+  }
+  U4_del_err = sqrt((n_small - 1.0) / n_small * U4_del_err);
+  printf("U4 jackknife: %.12e %.12e\n", U4_del_err,
+         JackknifeU4(m2_small, m4_small));
+  assert(fabs(U4_del_err - JackknifeU4(m2_small, m4_small)) < 1.0e-12);
+
+  // blocked bootstrap and jackknife errors of U4 should agree, and should not
+  // depend on the number of threads
+  auto U4_func = [](const std::vector<double>& m) {
+    return 1.5 * (1.0 - m[1] / (3.0 * m[0] * m[0]));
+  };
+  QfeResample resample({&m2, &m4}, 100);
+  double U4_jack_err, U4_boot_err_1t, U4_boot_err_4t;
+  double U4_jack = resample.Jackknife(U4_func, U4_jack_err);
+  resample.Bootstrap(U4_func, U4_boot_err_1t, 2000, 1234, 1);
+  std::vector<double> boot_1t = resample.samples;
+  double U4_boot = resample.Bootstrap(U4_func, U4_boot_err_4t, 2000, 1234, 4);
+  printf("U4 (jackknife): %.6f %.6f\n", U4_jack, U4_jack_err);
+  printf("U4 (bootstrap): %.6f %.6f\n", U4_boot, U4_boot_err_4t);
+  assert(fabs(U4_jack - U4_direct) < 1.0e-12);
+  assert(boot_1t == resample.samples);
+  assert(U4_boot_err_1t == U4_boot_err_4t);
+  assert(fabs(U4_boot_err_4t / U4_jack_err - 1.0) < 0.2);
+
+  // binning should increase the error estimate for correlated samples
+  double m2_err_1 = JackknifeMean(m2);
+  double m2_err_b = JackknifeMean(m2, 50);
+  printf("m^2 jackknife: %.6e (unbinned) %.6e (50 bins)\n", m2_err_1,
+         m2_err_b);
+  double m2_mean = Mean(m2);
+  double m2_var = 0.0;
+  for (int i = 0; i < m2.size(); i++) {
+    m2_var += (m2[i] - m2_mean) * (m2[i] - m2_mean);
+  }
+  m2_var /= m2.size() - 1.0;
+  assert(fabs(m2_err_1 - sqrt(m2_var / m2.size())) < 1.0e-12 * m2_err_1);
+  assert(m2_err_b > m2_err_1);
+
+  // compare the fft autocorrelation function with the direct sum
+  std::vector<double> gamma = AutocorrFunction(m2_small);
+  for (int n = 0; n < n_small; n += 50) {
+    assert(fabs(gamma[n] - AutocorrGamma(m2_small, n)) < 1.0e-12 * gamma[0]);
+  }
+
+  // an AR(1) process x_{i+1} = rho x_i + noise has tau_int =
+  // (1 + rho) / (2 (1 - rho))
+  double rho = 0.9;
+  int n_ar = 1000000;
+  std::mt19937 gen(1234);
+  std::normal_distribution<double> noise;
+  std::vector<double> x(n_ar);
+  x[0] = noise(gen);
+  for (int i = 1; i < n_ar; i++) x[i] = rho * x[i - 1] + noise(gen);
+  double tau_err;
+  int window;
+  double tau = AutocorrTimeWindowed(x, tau_err, window);
+  double tau_exact = 0.5 * (1.0 + rho) / (1.0 - rho);
+  printf("tau_int: %.4f %.4f (window %d) exact: %.4f\n", tau, tau_err, window,
+         tau_exact);
+  assert(fabs(tau - tau_exact) < 5.0 * tau_err);
+
+  // measurements that weren't kept for the autocorrelation time give 0
+  std::vector<double> empty;
+  assert(AutocorrTime(empty) == 0.0);
+  QfeMeasReal no_autocorr;
+  no_autocorr.Measure(1.0, false);
+  no_autocorr.Measure(2.0, false);
+  assert(no_autocorr.AutocorrFront() == 0.0);
+  assert(no_autocorr.AutocorrBack() == 0.0);
+
+  // the logarithmic binning in QfeMeasReal should find the same tau_int when
+  // there are enough blocks that are much longer than tau_int
+  QfeMeasReal x_meas;
+  for (int i = 0; i < n_ar; i++) x_meas.Measure(x[i]);
+  double tau_binned = x_meas.BinnedAutocorrTime(1000);
+  printf("tau_int (binned): %.4f levels: %d\n", tau_binned,
+         int(x_meas.bin_n.size()));
+  assert(fabs(tau_binned - tau_exact) < 0.1 * tau_exact);
+
+  // the binning levels should survive writing and reading the measurement
+  FILE* file = fopen("statistics_test.dat", "w");
+  x_meas.WriteMeasurement(file);
+  fprintf(file, "%.16e %.16e %d\n", 1.0, 0.1, 100);  // old format
+  fclose(file);
+  file = fopen("statistics_test.dat", "r");
+  QfeMeasReal x_read;
+  QfeMeasReal old_read;
+  x_read.ReadMeasurement(file);
+  old_read.ReadMeasurement(file);
+  fclose(file);
+  remove("statistics_test.dat");
+  assert(x_read.n == x_meas.n);
+  assert(x_read.bin_n == x_meas.bin_n);
+  assert(x_read.BinnedError() == x_meas.BinnedError());
+  for (int i = 0; i < 1000; i++) {
+    x_read.Measure(x[i]);
+    x_meas.Measure(x[i]);
+  }
+  assert(x_read.BinnedError() == x_meas.BinnedError());
+  assert(old_read.n == 100);
+  assert(fabs(old_read.Mean() - 1.0) < 1.0e-12);
+  assert(fabs(old_read.Error() - 0.1) < 1.0e-12);
+
+  // measuring chunks of the series separately (e.g. on different threads) and
+  // merging them should give the same result as measuring the whole series
+  int n_chunks = 7;
+  std::vector<QfeMeasReal> chunk_meas(n_chunks);
+  for (int i = 0; i < n_ar; i++) {
+    chunk_meas[(long(i) * n_chunks) / n_ar].Measure(x[i]);
+  }
+  QfeMeasReal x_whole;
+  QfeMeasReal x_merged;
+  for (int i = 0; i < n_ar; i++) x_whole.Measure(x[i]);
+  for (int c = 0; c < n_chunks; c++) x_merged.Merge(chunk_meas[c]);
+  printf("merged: %.16e %.16e\n", x_merged.Mean(), x_merged.Error());
+  printf("whole:  %.16e %.16e\n", x_whole.Mean(), x_whole.Error());
+  assert(x_merged.n == x_whole.n);
+  assert(fabs(x_merged.Mean() - x_whole.Mean()) < 1.0e-12 * x_whole.Error());
+  assert(fabs(x_merged.Error() / x_whole.Error() - 1.0) < 1.0e-12);
+  assert(x_merged.bin_n == x_whole.bin_n);
+  assert(x_merged.last_1000 == x_whole.LastMeasurements());
+  assert(x_merged.first_1000 == x_whole.first_1000);
+  double tau_merged = x_merged.BinnedAutocorrTime(1000);
+  printf("tau_int (merged): %.4f\n", tau_merged);
+  assert(fabs(tau_merged - tau_exact) < 0.1 * tau_exact);
+
+  // write the series to a binary log in two parts, then read it back
+  remove("statistics_test.log");
+  for (int part = 0; part < 2; part++) {
+    QfeMeasLog log;
+    std::map<std::string, std::string> params;
+    params["rho"] = "0.9";
+    bool log_opened =
+        log.Open("statistics_test.log", {"x", "x2"}, params, false, 1000);
+    assert(log_opened);
+    for (int i = part * n_ar / 2; i < (part + 1) * n_ar / 2; i++) {
+      log.Write({x[i], x[i] * x[i]});
+    }
+  }
+  QfeMeasLogReader reader;
+  bool reader_opened = reader.Open("statistics_test.log");
+  assert(reader_opened);
+  assert(reader.n_rows == n_ar);
+  assert(reader.params["rho"] == "0.9");
+  std::vector<double> x_log = reader.Read(reader.Column("x"));
+  assert(x_log == x);
+  QfeMeasReal x2_log;
+  reader.Measure(reader.Column("x2"), x2_log);
+  assert(x2_log.n == n_ar);
+  reader.Close();
+
+  // a log with different columns can't be appended to
+  QfeMeasLog bad_log;
+  bool bad_log_opened = bad_log.Open("statistics_test.log", {"y"});
+  assert(!bad_log_opened);
+  remove("statistics_test.log");
+
+  // rows written to a log that isn't open are dropped
+  bad_log.Write({1.0});
+  assert(bad_log.n_buf == 0);
+
+  // a header size larger than the file is rejected
+  FILE* log_file = fopen("statistics_test.log", "wb");
+  uint32_t bad_header_size = 0xFFFFFFF0;
+  fwrite(QFE_MEAS_LOG_MAGIC, 1, 8, log_file);
+  fwrite(&bad_header_size, sizeof(uint32_t), 1, log_file);
+  fclose(log_file);
+  bool bad_header_opened = bad_log.Open("statistics_test.log", {"x"});
+  assert(!bad_header_opened);
+  remove("statistics_test.log");
+
+  return 0;
+}
@@ -0,0 +1,138 @@
+// tempering_test.cc
+
+#include "tempering.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "ising.h"
+#include "phi4.h"
+#include "statistics.h"
+
+// Parallel tempering should not change the equilibrium distribution at each
+// coupling. We run a ladder of ising replicas on a 16^2 square lattice through
+// the critical point at beta_c = ln(1 + sqrt(2)) / 2 and compare the action at
+// the two ends of the ladder with independent runs at the same couplings.
+
+int main(int argc, char* argv[]) {
+  int N = 16;
+  QfeLattice lattice;
+  lattice.InitRect(N, N, 1.0, 1.0);
+  lattice.SeedRng(1234);
+
+  int n_replicas = 8;
+  std::vector<double> betas(n_replicas);
+  for (int k = 0; k < n_replicas; k++) {
+    betas[k] = 0.3 + 0.3 * k / (n_replicas - 1);
+  }
+  auto make_ising = [](QfeLattice* l, double beta) {
+    return QfeIsing(l, beta);
+  };
+  auto update_ising = [](QfeIsing& field) { field.Metropolis(); };
+
+  // check that the result does not depend on the number of threads
+  QfeTempering<QfeIsing> pt_1t(&lattice, betas, make_ising);
+  QfeTempering<QfeIsing> pt_4t(&lattice, betas, make_ising);
+  pt_1t.SeedRng(5678);
+  pt_4t.SeedRng(5678);
+  for (int r = 0; r < n_replicas; r++) {
+    pt_1t.replicas[r].HotStart();
+    pt_4t.replicas[r].HotStart();
+  }
+  for (int n = 0; n < 100; n++) {
+    pt_1t.Sweep(update_ising, 1);
+    pt_4t.Sweep(update_ising, 4);
+    pt_1t.Swap();
+    pt_4t.Swap();
+  }
+  assert(pt_1t.slot_replica == pt_4t.slot_replica);
+  for (int r = 0; r < n_replicas; r++) {
+    assert(pt_1t.replicas[r].spin == pt_4t.replicas[r].spin);
+  }
+
+  // adjust the ladder during thermalization
+  QfeTempering<QfeIsing> pt(&lattice, betas, make_ising);
+  for (int r = 0; r < n_replicas; r++) pt.replicas[r].HotStart();
+  for (int n = 0; n < 4000; n++) {
+    pt.Sweep(update_ising, 0);
+    pt.Swap();
+    if (n % 1000 == 999) pt.AdjustLadder();
+  }
+  assert(pt.Coupling(0) == betas[0]);
+  assert(pt.Coupling(n_replicas - 1) == betas[n_replicas - 1]);
+  for (int k = 0; k < n_replicas; k++) {
+    assert(pt.Replica(k).beta == pt.Coupling(k));
+  }
+
+  QfeMeasReal pt_action_lo;
+  QfeMeasReal pt_action_hi;
+  int n_traj = 20000;
+  for (int n = 0; n < n_traj; n++) {
+    pt.Sweep(update_ising, 0);
+    pt.Swap();
+    pt_action_lo.Measure(pt.Replica(0).Action());
+    pt_action_hi.Measure(pt.Replica(n_replicas - 1).Action());
+  }
+  for (int k = 0; k < n_replicas - 1; k++) {
+    printf("%.4f %.4f %.4f\n", pt.Coupling(k), pt.Coupling(k + 1),
+           pt.SwapRate(k));
+  }
+  printf("round trips: %d\n", pt.n_round_trips);
+  assert(pt.n_round_trips > 0);
+
+  // independent runs at the ends of the ladder
+  QfeMeasReal action_lo;
+  QfeMeasReal action_hi;
+  QfeIsing field_lo(&lattice, betas[0]);
+  QfeIsing field_hi(&lattice, betas[n_replicas - 1]);
+  field_lo.HotStart();
+  field_hi.ColdStart();
+  for (int n = 0; n < 1000; n++) {
+    field_lo.Metropolis();
+    field_hi.Metropolis();
+    field_hi.WolffUpdate();
+  }
+  for (int n = 0; n < n_traj; n++) {
+    field_lo.Metropolis();
+    field_hi.Metropolis();
+    field_hi.WolffUpdate();
+    action_lo.Measure(field_lo.Action());
+    action_hi.Measure(field_hi.Action());
+  }
+
+  printf("action (lo): %.6f %.6f %.6f %.6f\n", pt_action_lo.Mean(),
+         pt_action_lo.Error(), action_lo.Mean(), action_lo.Error());
+  printf("action (hi): %.6f %.6f %.6f %.6f\n", pt_action_hi.Mean(),
+         pt_action_hi.Error(), action_hi.Mean(), action_hi.Error());
+  assert(fabs(pt_action_lo.Mean() - action_lo.Mean()) <
+         5.0 * hypot(pt_action_lo.Error(), action_lo.Error()));
+  assert(fabs(pt_action_hi.Mean() - action_hi.Mean()) <
+         5.0 * hypot(pt_action_hi.Error(), action_hi.Error()));
+
+  // check that swaps keep the tracked phi4 action up to date
+  std::vector<double> msqs = {-1.4, -1.3, -1.2, -1.1};
+  QfeTempering<QfePhi4> pt_phi4(
+      &lattice, msqs, [](QfeLattice* l, double msq) {
+        return QfePhi4(l, msq, 0.25);
+      });
+  for (int r = 0; r < msqs.size(); r++) {
+    pt_phi4.replicas[r].HotStart();
+    pt_phi4.replicas[r].StartTracking(1000000);
+  }
+  for (int n = 0; n < 100; n++) {
+    pt_phi4.Sweep([](QfePhi4& field) {
+      field.Metropolis();
+      field.WolffUpdate();
+    });
+    pt_phi4.Swap();
+  }
+  for (int k = 0; k < msqs.size(); k++) {
+    QfePhi4& field = pt_phi4.Replica(k);
+    assert(field.msq == msqs[k]);
+    assert(fabs(field.TrackedAction() - field.Action()) < 1.0e-10);
+  }
+
+  return 0;
+}